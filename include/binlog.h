@@ -0,0 +1,84 @@
+#ifndef binlog_h
+#define binlog_h
+
+#include <Arduino.h>
+#include <type_traits>
+
+// Deferred binary logging, built with -D LOG_BINARY.
+// A logd() call site records only the FNV-1a hash of its format string, the time
+// and its raw arguments; the text is put back together on the host by tools/logdecode.py,
+// which finds the format strings in the sources.
+//
+// Record: [length][format id, 4 bytes LE][ms since previous record, varint][args]
+// Args: integers as zigzag varints (32 bit), floating point as 4 byte floats,
+//       strings as a varint length followed by the bytes.
+
+#define BINLOG_RECORD_SIZE  160
+#define BINLOG_STRING_MAX   96
+
+struct BinLogRecord {
+  uint8_t Data[BINLOG_RECORD_SIZE];
+  size_t Len = 0;
+
+  void put(uint8_t b) {
+    if(Len < BINLOG_RECORD_SIZE) {
+      Data[Len++] = b;
+    }
+  }
+
+  void putVarint(uint32_t v) {
+    while(v >= 0x80) {
+      put((uint8_t)(v | 0x80));
+      v >>= 7;
+    }
+    put((uint8_t)v);
+  }
+};
+
+inline void binLogArg(BinLogRecord& rec, const char* s) {
+  if(NULL == s) {
+    s = "(null)";
+  }
+  size_t len = strnlen(s, BINLOG_STRING_MAX);
+  rec.putVarint(len);
+  for(size_t n = 0; n < len; n++) {
+    rec.put(s[n]);
+  }
+}
+
+inline void binLogArg(BinLogRecord& rec, double d) {
+  float f = (float)d;
+  uint8_t b[4];
+  memcpy(b, &f, sizeof(b));
+  for(int n = 0; n < 4; n++) {
+    rec.put(b[n]);
+  }
+}
+
+// Signed and unsigned values are encoded alike, the format string tells them apart.
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value>::type binLogArg(BinLogRecord& rec, T v) {
+  int32_t i = (int32_t)v;
+  rec.putVarint(((uint32_t)i << 1) ^ (uint32_t)(i >> 31));
+}
+
+inline void binLogArgs(BinLogRecord& rec) {}
+
+template <typename T, typename... Args>
+void binLogArgs(BinLogRecord& rec, T first, Args... rest) {
+  binLogArg(rec, first);
+  binLogArgs(rec, rest...);
+}
+
+void beginBinaryLog(BinLogRecord& rec, uint32_t formatId);
+void appendBinaryLog(BinLogRecord& rec);
+
+template <typename... Args>
+void logDeferred(uint32_t formatId, Args... args) {
+  BinLogRecord rec;
+  beginBinaryLog(rec, formatId);
+  binLogArgs(rec, args...);
+  appendBinaryLog(rec);
+}
+
+#endif // binlog_h
@@ -6,6 +6,13 @@
 #define GDOOR_MONITOR_VERSION   __DATE__ " " __TIME__
 #define DEVICE_ID           "gdoor"
 
+// Doors watched by one board, at most 2. The position sensors share the ADC, see pins.h.
+#ifndef DOOR_COUNT
+#define DOOR_COUNT          1
+#endif
+static_assert(DOOR_COUNT >= 1 && DOOR_COUNT <= 2, "DOOR_COUNT must be 1 or 2");
+
+#define DOOR_UNSTABLE (-2) // sensor readings haven't settled
 #define DOOR_UNKNOWN (-1)
 #define DOOR_OPEN 0
 #define DOOR_CLOSED 1
@@ -21,13 +28,30 @@
 #define IOT_EVENT_CLOSED_DOOR 6
 #define IOT_EVENT_CONFIG_ERROR 7
 #define IOT_EVENT_CONTROL_DISABLED 8
+#define IOT_EVENT_SLOW_DOOR 9
 
 #define IOT_API_BASE_URL "http://" IOT_SERVICE_FQDN "/cgi-bin/luci/iot-helper/api"
 
+// Per door settings. Door 0 has the plain config keys, door 1 the same keys prefixed with "Door1".
+struct DoorConfig {
+  // Weekly windows, e.g. "Mon-Fri 2200-0530, Sat+Sun 2330-0800", see schedule.cpp.
+  // Empty for door 1 means the same schedule as door 0.
+  char KeepClosedSchedule[160] = "";
+
+  int SensorRangeValues[DOOR_STATE_COUNT][2] = {
+    { 900, 1024 },  // open switch on
+    { 300, 700 },   // closed switch on
+    { 0, 100 }       // ajar, no switch set
+  };
+};
+
 struct ApplicationConfig {
   bool EnableControl = true;
-  unsigned long MainLoopMs = 5 * 1000; // 5 seconds.
-  unsigned long UpdateConfigMs = 60 * 1000; // 1 minute. Also keeps the clock.
+  unsigned long MainLoopMs = 5 * 1000; // 5 seconds. Housekeeping, and door checks while a door is open.
+  unsigned long MainLoopFastMs = 250;   // door checks while a door moves or its readings change
+  unsigned long MainLoopIdleMs = 60 * 1000; // door checks once all doors have been closed for a while
+  unsigned long UpdateConfigMs = 60 * 1000; // 1 minute
+  unsigned long TimeSyncMs = 60 * 60 * 1000; // 1 hour between SNTP syncs
   int MaxClosingTries = 2;
   unsigned long DoorClosingTimeMs = 20 * 1000; // 20 seconds for the door to close
   unsigned long TimeBetweenClosingAttemptsMs = 15 * 60 * 1000; // 15 minutes
@@ -35,18 +59,22 @@ struct ApplicationConfig {
   unsigned long MaxDoorOpenMs = 6 * 60 * 60 * 1000; // 6 hours max for door to stay open
   unsigned long MinDoorOpenMs = 5 * 60 * 1000;      // 5 minutes at least to stay open, so it doesn't go closing right away
   unsigned long MinNotifyPeriodMs = 5 * 60 * 1000;  // 5 minutes
-  int DebounceReadCount = 5;
-  int DebounceReadPauseMs = 500;
+  int DebounceReadCount = 5;     // same state samples in a row for the state to be stable
+  int DebounceReadPauseMs = 100; // sensor sampling period
   bool DebugLog = false;
   bool PostLog = true;
+  unsigned long LogFlushMs = 30 * 1000; // post buffered log lines at least this often
+  int LogFlushLines = 20;                // or once that many lines are buffered
 
-  int KeepClosedFromTo[2] = { 2200, 500 };
+  int KeepClosedFromTo[2] = { 2200, 500 };  // every day, unless there is a KeepClosedSchedule
+  // Dates that follow the Sunday windows, MMDD or YYYYMMDD, e.g. "0101 1225 20261126".
+  char KeepClosedHolidays[120] = "";
 
-  int SensorRangeValues[DOOR_STATE_COUNT][2] = {
-    { 900, 1024 },  // open switch on
-    { 300, 700 },   // closed switch on
-    { 0, 100 }       // ajar, no switch set
-  };
+  DoorConfig Doors[DOOR_COUNT];
+
+  unsigned long MetricsReportMs = 60 * 60 * 1000; // 1 hour. Loop stage timings get logged that often, 0 to never.
+  bool AutoCalibrateSensor = false; // apply the sensor ranges found from the readings, or just report them
+  bool LogRawSensor = false;        // log every position sensor sample, the traces for the native replay
 
   // evaluated values
   char txtMinOpenTime[24];
@@ -55,15 +83,209 @@ struct ApplicationConfig {
 
 extern ApplicationConfig AppConfig;
 
+// FNV-1a, same as hashText(), usable at compile time.
+constexpr uint32_t hashKey(const char* key, uint32_t hash = 2166136261UL) {
+  return *key ? hashKey(key + 1, (hash ^ (uint8_t)*key) * 16777619UL) : hash;
+}
+
+uint32_t hashText(const char* text, size_t len);
+
 const char* log(const char* format, ...);
+#ifdef LOG_BINARY
+#include <binlog.h>
+#define logd(format, ...) {if(AppConfig.DebugLog) { constexpr uint32_t formatId = hashKey(format); logDeferred(formatId, ##__VA_ARGS__); }};
+#else
 #define logd(...) {if(AppConfig.DebugLog) log(__VA_ARGS__);};
+#endif
 char* formatMillis(char* buff, unsigned long milliseconds);
 
+struct HttpStats {
+  unsigned long Requests = 0;
+  unsigned long Reused = 0;   // requests sent over an already open connection
+  unsigned long Failures = 0;
+  unsigned long LastLatencyMs = 0;
+  unsigned long MaxLatencyMs = 0;
+  unsigned long TotalLatencyMs = 0;
+  unsigned long BytesSent = 0;
+};
+extern HttpStats IotHttpStats;
+
+#define WIRE_JSON       0
+#define WIRE_MSGPACK    1
+extern int IotWireFormat;
+
+#define TIME_SOURCE_NONE        0
+#define TIME_SOURCE_HEADER      1
+#define TIME_SOURCE_SNTP        2
+#define TIME_SOURCE_RESTORED    3 // carried over a reset
+
+#define TIME_CONFIDENCE_NONE    0 // no time, or too far off to use
+#define TIME_CONFIDENCE_LOW     1 // within a minute
+#define TIME_CONFIDENCE_GOOD    2 // within a couple of seconds
+
+struct TimeSyncStats {
+  int Source = TIME_SOURCE_NONE;
+  unsigned long LastSyncMs = 0;
+  long LastOffsetMs = 0;    // clock correction at the last SNTP sync
+  float DriftPpm = 0;       // how much faster real time runs than millis()
+  bool DriftKnown = false;
+  long TzOffsetSec = 0;
+  unsigned long SntpSyncs = 0;
+  unsigned long SntpFailures = 0;
+  unsigned long HeaderSyncs = 0;
+};
+extern TimeSyncStats IotTimeSync;
+
+// Clock state kept over a reset.
+struct TimeCheckpoint {
+  uint64_t UtcMs;       // 0 when there was no time
+  uint32_t ErrorMs;
+  int32_t TzOffsetSec;
+  float DriftPpm;
+  uint8_t DriftKnown;
+  uint8_t TzOffsetKnown;
+};
+
+void startTimeSync();
+void serviceTimeSync();
+void syncTimeFromHeader(time_t localTime, unsigned long latencyMs);
+uint64_t utcNowMs();
+unsigned long timeErrorMs();
+void checkpointTime(TimeCheckpoint& cp);
+void restoreTime(const TimeCheckpoint& cp, unsigned long gapMs);
+int timeConfidence();
+const char* getNamedTimeConfidence(int confidence);
+const char* getNamedTimeSource(int source);
+size_t formatTimeMetrics(char* buff, size_t size);
+
+class HTTPClient;
+HTTPClient& iotHttpBegin(const char* url, uint16_t timeoutMs);
+void iotHttpEnd(int code, size_t bytesSent = 0);
+
+extern unsigned long doorOpenedSinceMs[DOOR_COUNT];
+extern unsigned long lastCloseAttemptMs[DOOR_COUNT];
+bool isClosingDoor();
+bool isClosingDoor(int door);
+
+#define CONFIG_BODY_SIZE    1536 // a config, as pulled or formatted
+size_t formatConfig(char* buff, size_t size);
+void saveConfigCache();
+void restoreConfig();
+
+void restorePersisted();
+void servicePersist();
+size_t readPersistedFile(const char* path, char* buff, size_t size);
+bool writePersistedFile(const char* path, const char* tmpPath, const void* data, size_t len);
+void startStatusServer();
+void serviceStatusServer();
+
+#define MQTT_TOPIC_EVENT    0
+#define MQTT_TOPIC_LOG      1
+#define MQTT_TOPIC_STATE    2
+#define MQTT_TOPIC_STATUS   3
+#define MQTT_TOPIC_BINLOG   4
+#define MQTT_TOPIC_JOURNAL  5
+#define MQTT_TOPIC_STATE1   6 // door 1 state
+#define MQTT_MAX_PAYLOAD    1536 // a config; log batches are sent in parts of at most that
+void startMqtt();
+void serviceMqtt();
+bool mqttConnected();
+void publishDoorState(int door, int doorState);
+bool mqttPublish(int topic, const uint8_t* payload, size_t len, bool retained = false);
+bool mqttPublishNow(int topic, const uint8_t* payload, size_t len, bool retained = false);
+void applyPushedConfig(const char* text, size_t len);
+
+// Record types, the door is added in the high nibble.
+#define JOURNAL_RESET           0
+#define JOURNAL_DOOR_STATE      1 // value: door state, detail: sensor value
+#define JOURNAL_CLOSE_ATTEMPT   2 // value: attempt, detail: door state
+#define JOURNAL_CLOSE_RESULT    3 // value: 1 closed, 0 failed, detail: door state
+#define JOURNAL_DOOR_TRAVEL     4 // value: 1 slow, detail: travel time in 100 ms
+
+struct JournalStats {
+  unsigned long Records = 0;
+  unsigned long Uploaded = 0;
+  unsigned long Dropped = 0;        // overwritten or lost before they were sent
+  unsigned long UploadFailures = 0;
+};
+extern JournalStats IotJournalStats;
+
+void startJournal();
+void serviceJournal();
+void journalEvent(int type, int value, int detail = 0, int door = 0);
+size_t formatJournalMetrics(char* buff, size_t size);
+
+// Door travel time profile, kept in flash.
+struct TravelProfile {
+  float MeanMs;
+  float VarMs2;
+  uint32_t LastMs;
+  uint16_t Count;       // closes measured
+  uint16_t Slow;        // closes reported as slow
+};
+extern TravelProfile DoorTravel[DOOR_COUNT];
+
+void recordDoorTravel(int door, unsigned long travelMs, bool slowReported);
+void reportSlowDoor(int door, unsigned long travelMs);
+unsigned long travelLimitMs(int door);
+size_t formatTravelMetrics(char* buff, size_t size, int door);
+
+void compileSchedule();
+bool isKeepClosedTime(int door, time_t t);
+long minutesToScheduleChange(int door, time_t t);
+
+void startSensorSampling();
+void serviceSensor();
+uint8_t takeSensorActivity();
+void logRawSensorSamples();
+int getDoorState(int door);
+const char* getNamedDoorState(int doorState);
+int getSensorValue(int door);
+extern int SensorCalibration[DOOR_COUNT][DOOR_STATE_COUNT][2];
+void applySensorCalibration();
+
+struct WiFiStats {
+  unsigned long Connects = 0;
+  unsigned long FastConnects = 0;   // with the cached access point and lease
+  unsigned long FastFailures = 0;
+  unsigned long Failures = 0;
+  unsigned long Drops = 0;
+  unsigned long LastConnectMs = 0;
+  unsigned long MaxConnectMs = 0;
+  unsigned long TotalConnectMs = 0;
+  unsigned long LastDownMs = 0;     // from losing the connection to having it back
+};
+extern WiFiStats IotWiFiStats;
+
+#define CADENCE_FAST    0
+#define CADENCE_NORMAL  1
+#define CADENCE_IDLE    2
+#define CADENCE_COUNT   3
+
+struct CadenceStats {
+  int Cadence = CADENCE_FAST;
+  unsigned long IntervalMs = 0;           // until the next door check
+  unsigned long Checks[CADENCE_COUNT] = { 0 };
+  unsigned long SensorWakes = 0;          // checks brought forward by the sensor
+  unsigned long DeadlineWakes = 0;        // intervals cut short for a door deadline
+};
+extern CadenceStats IotCadence;
+size_t formatCadenceMetrics(char* buff, size_t size);
+
+void startWiFi();
+void serviceWiFi();
 bool ensureWiFi();
 bool wifiConnected();
+const char* getNamedWiFiState();
+size_t formatWiFiMetrics(char* buff, size_t size);
 void updateConfig(bool force = false);
-void closingDoorAlarm();
-bool sendNotification(int eventId, const char* msg = NULL, int msgLen = 0);
+void startClosingDoorAlarm();
+bool closingDoorAlarmDone();
+void updateStatusLed();
+bool sendNotification(int eventId, const char* msg = NULL, int msgLen = 0, int door = -1);
+void processNotifications();
 void postLog(const char* logMsg);
+void flushLog();
+void flushBinaryLog();
 
 #endif // main_h
\ No newline at end of file
@@ -0,0 +1,46 @@
+#ifndef metrics_h
+#define metrics_h
+
+#include <Arduino.h>
+
+// Main loop stages that get timed
+#define STAGE_LOOP          0
+#define STAGE_CONFIG        1
+#define STAGE_CHECK_DOOR    2
+#define STAGE_NOTIFY        3
+#define STAGE_LOG           4
+#define STAGE_WIFI_CONNECT  5 // starting a connect, the only part of the WiFi state machine that may block
+#define STAGE_COUNT         6
+
+// Latency histogram over power of 2 microsecond buckets: bucket b counts [2^b, 2^(b+1)) us.
+#define LATENCY_BUCKETS     25  // up to ~33 seconds
+struct LatencyHistogram {
+  uint32_t Buckets[LATENCY_BUCKETS];
+  uint32_t Count;
+  uint32_t MinUs;
+  uint32_t MaxUs;
+
+  void add(uint32_t us);
+  uint32_t percentile(int p) const;
+  void reset();
+};
+
+extern LatencyHistogram StageLatency[STAGE_COUNT];
+
+// Times the enclosing scope into the stage histogram.
+class StageTimer {
+public:
+  StageTimer(int stage) : _stage(stage), _startUs(micros()) {}
+  ~StageTimer() { StageLatency[_stage].add(micros() - _startUs); }
+
+private:
+  int _stage;
+  unsigned long _startUs;
+};
+
+#define TIME_STAGE(stage) StageTimer stageTimer(stage)
+
+size_t formatMetrics(char* buff, size_t size);
+void reportMetrics();
+
+#endif // metrics_h
@@ -0,0 +1,73 @@
+#ifndef msgpack_h
+#define msgpack_h
+
+#include <Arduino.h>
+
+// Minimal MessagePack writer and reader over fixed buffers, for the compact wire format.
+// Only the types the device sends and expects: nil, bool, integers, strings, arrays and maps.
+
+#define MSGPACK_CONTENT_TYPE  "application/msgpack"
+
+class MsgPackWriter {
+public:
+  MsgPackWriter(uint8_t* buff, size_t size) : _buff(buff), _size(size) {}
+
+  void writeNil();
+  void writeBool(bool b);
+  void writeInt(long v);
+  void writeUint(unsigned long v);
+  void writeStr(const char* s, size_t len);
+  void writeStr(const char* s) { writeStr(s, strlen(s)); }
+  void writeArray(size_t count);
+  void writeMap(size_t count);
+
+  size_t length() const { return _len; }
+  bool overflow() const { return _overflow; }
+
+private:
+  void put(uint8_t b);
+  void putBE(uint32_t v, int bytes);
+
+  uint8_t* _buff;
+  size_t _size;
+  size_t _len = 0;
+  bool _overflow = false;
+};
+
+#define MSGPACK_NIL     0
+#define MSGPACK_BOOL    1
+#define MSGPACK_INT     2
+#define MSGPACK_STR     3
+#define MSGPACK_ARRAY   4
+#define MSGPACK_MAP     5
+#define MSGPACK_OTHER   6 // floats, binary, extensions: only skipped
+#define MSGPACK_MAX_DEPTH 8 // nested arrays and maps skip() goes into, deeper is an error
+
+class MsgPackReader {
+public:
+  MsgPackReader(const uint8_t* data, size_t len) : _data(data), _len(len) {}
+
+  int peekType();
+  bool readNil();
+  bool readBool(bool& b);
+  bool readInt(long& v);
+  bool readStr(const char*& s, size_t& len); // points into the data, not terminated
+  bool readArray(size_t& count);
+  bool readMap(size_t& count);
+  bool skip(int depth = 0);
+
+  bool atEnd() const { return _pos >= _len; }
+  bool error() const { return _error; }
+
+private:
+  bool get(uint8_t& b);
+  bool getBE(uint32_t& v, int bytes);
+  bool fail() { _error = true; return false; }
+
+  const uint8_t* _data;
+  size_t _len;
+  size_t _pos = 0;
+  bool _error = false;
+};
+
+#endif // msgpack_h
@@ -0,0 +1,24 @@
+#ifndef pattern_h
+#define pattern_h
+
+// Background on/off patterns for the buzzer and LEDs, driven by Ticker.
+
+#define PATTERN_BUZZER      0
+#define PATTERN_LED_RED     1
+#define PATTERN_LED_BLUE    2
+#define PATTERN_CHANNEL_COUNT 3
+
+struct PatternStep {
+  unsigned int OnMs;
+  unsigned int OffMs;
+  unsigned int Repeat; // how many on/off cycles of this step
+};
+
+// Called from the timer context when a (non looping) pattern ends. Keep it short.
+typedef void (*PatternDoneCallback)(int channel);
+
+void startPattern(int channel, const PatternStep* steps, int stepCount, bool loop = false, PatternDoneCallback onDone = NULL);
+void stopPattern(int channel);
+bool patternRunning(int channel);
+
+#endif // pattern_h
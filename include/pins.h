@@ -5,6 +5,11 @@
 #define GDOOR_PIN           D1
 #define BUZZER_PIN          D2
 
+// Second door (DOOR_COUNT 2). The ESP8266 has a single ADC: both position sensors go to A0
+// through an analog switch, SENSOR_SELECT_PIN low for door 0, high for door 1.
+#define GDOOR2_PIN          D6
+#define SENSOR_SELECT_PIN   D5
+
 #define LED_BLUE_PIN      D4 // ESP8266. Pulled up. Inverted logic.
 #define LED_RED_PIN       D0 // NodeMCU. Pulled up. Inverted logic.
 
@@ -0,0 +1,142 @@
+#ifndef native_arduino_h
+#define native_arduino_h
+
+// Just enough of the Arduino/ESP8266 core to build the monitor on the host.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <math.h>
+#include <algorithm>
+#include <string>
+
+using std::min;
+using std::max;
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+typedef uint8_t byte;
+
+#define HIGH 0x1
+#define LOW  0x0
+#define INPUT  0x00
+#define OUTPUT 0x01
+
+// NodeMCU pin numbers
+#define A0 17
+#define D0 16
+#define D1 5
+#define D2 4
+#define D3 0
+#define D4 2
+#define D5 14
+#define D6 12
+#define D7 13
+#define D8 15
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define F(s) (s)
+#define ICACHE_RAM_ATTR
+#define IRAM_ATTR
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void yield();
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+
+class String {
+public:
+  String() {}
+  String(const char* text) : _s(text ? text : "") {}
+  String(const std::string& text) : _s(text) {}
+  String(int value) : _s(std::to_string(value)) {}
+
+  const char* c_str() const { return _s.c_str(); }
+  unsigned int length() const { return _s.length(); }
+  bool isEmpty() const { return _s.empty(); }
+  long toInt() const { return atol(_s.c_str()); }
+  bool equalsIgnoreCase(const String& other) const { return strcasecmp(_s.c_str(), other.c_str()) == 0; }
+  bool startsWith(const String& prefix) const { return _s.compare(0, prefix._s.size(), prefix._s) == 0; }
+  bool operator==(const String& other) const { return _s == other._s; }
+  bool operator==(const char* other) const { return _s == other; }
+  String& operator+=(const String& other) { _s += other._s; return *this; }
+  String& operator+=(const char* other) { _s += other; return *this; }
+  String& operator+=(char c) { _s += c; return *this; }
+  friend String operator+(const String& a, const String& b) { return String(a._s + b._s); }
+
+private:
+  std::string _s;
+};
+
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t* buffer, size_t size) {
+    size_t n = 0;
+    while(n < size && write(buffer[n])) {
+      n++;
+    }
+    return n;
+  }
+  virtual int availableForWrite() { return 0; }
+
+  size_t write(const char* text) { return write((const uint8_t*) text, strlen(text)); }
+  size_t print(const char* text) { return write(text); }
+  size_t print(const String& text) { return write(text.c_str()); }
+  size_t println(const char* text) { return print(text) + print("\n"); }
+  size_t println(const String& text) { return println(text.c_str()); }
+  size_t println() { return print("\n"); }
+  size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+};
+
+class Stream : public Print {
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+  virtual void flush() {}
+  void setTimeout(unsigned long timeoutMs) { _timeoutMs = timeoutMs; }
+  size_t readBytes(char* buffer, size_t length);
+  size_t readBytes(uint8_t* buffer, size_t length) { return readBytes((char*) buffer, length); }
+
+protected:
+  unsigned long _timeoutMs = 1000;
+};
+
+class HardwareSerial : public Stream {
+public:
+  void begin(unsigned long baud) {}
+  size_t write(uint8_t c);
+  size_t write(const uint8_t* buffer, size_t size);
+  using Print::write;
+  int availableForWrite() { return 256; }
+  int available() { return 0; }
+  int read() { return -1; }
+  int peek() { return -1; }
+};
+
+extern HardwareSerial Serial;
+
+class EspClass {
+public:
+  uint32_t getFreeHeap() { return 40 * 1024; }
+  uint32_t getMaxFreeBlockSize() { return 32 * 1024; }
+  uint32_t getChipId() { return 0x00c0ffee; }
+  bool rtcUserMemoryRead(uint32_t offset, uint32_t* data, size_t size);
+  bool rtcUserMemoryWrite(uint32_t offset, uint32_t* data, size_t size);
+  void restart();
+};
+
+extern EspClass ESP;
+
+#endif // native_arduino_h
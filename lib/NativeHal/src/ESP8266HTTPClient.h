@@ -0,0 +1,57 @@
+#ifndef native_esp8266httpclient_h
+#define native_esp8266httpclient_h
+
+// HTTPClient stand-in. Requests are answered by the handler set with halSetHttpHandler().
+
+#include <ESP8266WiFi.h>
+#include <hal.h>
+
+#define HTTPC_ERROR_CONNECTION_FAILED   (-1)
+#define HTTPC_ERROR_SEND_HEADER_FAILED  (-2)
+#define HTTPC_ERROR_SEND_PAYLOAD_FAILED (-3)
+#define HTTPC_ERROR_NOT_CONNECTED       (-4)
+#define HTTPC_ERROR_CONNECTION_LOST     (-5)
+#define HTTPC_ERROR_NO_STREAM           (-6)
+#define HTTPC_ERROR_NO_HTTP_SERVER      (-7)
+#define HTTPC_ERROR_TOO_LESS_RAM        (-8)
+#define HTTPC_ERROR_ENCODING            (-9)
+#define HTTPC_ERROR_STREAM_WRITE        (-10)
+#define HTTPC_ERROR_READ_TIMEOUT        (-11)
+
+#define HTTP_CODE_OK            200
+#define HTTP_CODE_NOT_MODIFIED  304
+
+class HTTPClient {
+public:
+  bool begin(WiFiClient& client, const String& url) { return begin(client, url.c_str()); }
+  bool begin(WiFiClient& client, const char* url);
+  void end();
+
+  void setReuse(bool reuse) { _reuse = reuse; }
+  void setTimeout(uint16_t timeoutMs) {}
+  void useHTTP10(bool useHTTP10) {}
+
+  void addHeader(const String& name, const String& value, bool first = false, bool replace = true);
+  void collectHeaders(const char* headerKeys[], const size_t headerKeysCount);
+  String header(const char* name);
+  bool hasHeader(const char* name);
+
+  int GET();
+  int POST(const uint8_t* payload, size_t size);
+  int POST(const String& payload) { return POST((const uint8_t*) payload.c_str(), payload.length()); }
+  int sendRequest(const char* type, const uint8_t* payload, size_t size);
+
+  int getSize() { return _response.Body.size(); }
+  String getString() { return String(_response.Body); }
+  int writeToStream(Stream* stream);
+  bool connected() { return _client != NULL && _client->connected(); }
+
+private:
+  WiFiClient* _client = NULL;
+  bool _reuse = false;
+  HalHttpRequest _request;
+  HalHttpResponse _response;
+  std::vector<std::string> _collect;
+};
+
+#endif // native_esp8266httpclient_h
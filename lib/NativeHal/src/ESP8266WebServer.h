@@ -0,0 +1,37 @@
+#ifndef native_esp8266webserver_h
+#define native_esp8266webserver_h
+
+// Web server stand-in on a real host socket, so it can be tried with curl.
+// Ports below 1024 are moved up by 8000 (80 becomes 8080).
+
+#include <functional>
+#include <vector>
+#include <Arduino.h>
+
+class ESP8266WebServer {
+public:
+  typedef std::function<void()> THandlerFunction;
+
+  ESP8266WebServer(int port = 80) : _port(port < 1024 ? port + 8000 : port) {}
+  ~ESP8266WebServer() { close(); }
+
+  void on(const String& uri, THandlerFunction handler) { _handlers.push_back({ uri.c_str(), handler }); }
+  void onNotFound(THandlerFunction handler) { _notFound = handler; }
+  void begin();
+  void close();
+  void handleClient();
+
+  void send(int code, const char* contentType, const String& content) { send(code, contentType, content.c_str()); }
+  void send(int code, const char* contentType, const char* content);
+  String uri() { return String(_uri); }
+
+private:
+  int _port;
+  int _listenFd = -1;
+  int _clientFd = -1;
+  std::string _uri;
+  std::vector<std::pair<std::string, THandlerFunction>> _handlers;
+  THandlerFunction _notFound;
+};
+
+#endif // native_esp8266webserver_h
@@ -0,0 +1,89 @@
+#ifndef native_esp8266wifi_h
+#define native_esp8266wifi_h
+
+#include <Arduino.h>
+#include <IPAddress.h>
+#include <Client.h>
+
+typedef enum {
+  WL_IDLE_STATUS = 0,
+  WL_NO_SSID_AVAIL = 1,
+  WL_SCAN_COMPLETED = 2,
+  WL_CONNECTED = 3,
+  WL_CONNECT_FAILED = 4,
+  WL_CONNECTION_LOST = 5,
+  WL_WRONG_PASSWORD = 6,
+  WL_DISCONNECTED = 7
+} wl_status_t;
+
+typedef enum { WIFI_OFF = 0, WIFI_STA = 1, WIFI_AP = 2, WIFI_AP_STA = 3 } WiFiMode_t;
+
+// A real host TCP socket once connect() is called, so e.g. an MQTT client can reach a local broker.
+// The HTTPClient stand-in only flags it as connected, to model keep-alive.
+class WiFiClient : public Client {
+public:
+  ~WiFiClient() { stop(); }
+
+  int connect(IPAddress ip, uint16_t port);
+  int connect(const char* host, uint16_t port);
+  uint8_t connected();
+  void stop();
+  void setNoDelay(bool noDelay) {}
+
+  size_t write(uint8_t c) { return write(&c, 1); }
+  size_t write(const uint8_t* buffer, size_t size);
+  using Print::write;
+  int availableForWrite() { return 1024; }
+  int available();
+  int read();
+  int read(uint8_t* buffer, size_t size);
+  int peek();
+  void flush() {}
+  operator bool() { return connected(); }
+
+  // used by the HTTPClient stand-in
+  void setConnected(bool connected) { _connected = connected; }
+
+private:
+  int _fd = -1;
+  bool _connected = false;
+};
+
+class WiFiUDP {
+public:
+  uint8_t begin(uint16_t port) { return 1; }
+  void stop() {}
+  int beginPacket(const char* host, uint16_t port);
+  int beginPacket(IPAddress ip, uint16_t port);
+  size_t write(const uint8_t* buffer, size_t size);
+  int endPacket();
+  int parsePacket();
+  int read(uint8_t* buffer, size_t size);
+};
+
+class ESP8266WiFiClass {
+public:
+  wl_status_t status();
+  wl_status_t begin(const char* ssid, const char* passphrase = NULL, int32_t channel = 0, const uint8_t* bssid = NULL, bool connect = true);
+  bool config(IPAddress local, IPAddress gateway, IPAddress subnet, IPAddress dns1 = IPAddress(), IPAddress dns2 = IPAddress()) { return true; }
+  bool disconnect(bool wifiOff = false);
+  void persistent(bool persistent) {}
+  bool mode(WiFiMode_t mode) { return true; }
+  bool setAutoReconnect(bool autoReconnect) { return true; }
+  bool setHostname(const char* hostname) { return true; }
+  bool hostname(const char* hostname) { return true; }
+  int hostByName(const char* host, IPAddress& result) { result = IPAddress(127, 0, 0, 1); return 1; }
+
+  IPAddress localIP() { return IPAddress(192, 168, 1, 50); }
+  IPAddress gatewayIP() { return IPAddress(192, 168, 1, 1); }
+  IPAddress subnetMask() { return IPAddress(255, 255, 255, 0); }
+  IPAddress dnsIP(uint8_t n = 0) { return IPAddress(192, 168, 1, 1); }
+  String macAddress() { return String("00:00:00:00:00:00"); }
+  uint8_t* BSSID();
+  int32_t channel() { return 6; }
+  int32_t RSSI() { return -60; }
+};
+
+extern ESP8266WiFiClass WiFi;
+
+#endif // native_esp8266wifi_h
@@ -0,0 +1,19 @@
+#ifndef native_ipaddress_h
+#define native_ipaddress_h
+
+#include <stdint.h>
+
+class IPAddress {
+public:
+  IPAddress() {}
+  IPAddress(uint32_t address) : _address(address) {}
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : _address(a | (b << 8) | (c << 16) | ((uint32_t) d << 24)) {}
+  uint8_t operator[](int index) const { return (_address >> (8 * index)) & 0xff; }
+  operator uint32_t() const { return _address; }
+  bool isSet() const { return _address != 0; }
+
+private:
+  uint32_t _address = 0;
+};
+
+#endif // native_ipaddress_h
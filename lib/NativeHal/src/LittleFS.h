@@ -0,0 +1,42 @@
+#ifndef native_littlefs_h
+#define native_littlefs_h
+
+#include <Arduino.h>
+#include <string>
+#include <vector>
+
+// Files are kept in memory, for the length of the run.
+enum SeekMode { SeekSet = 0, SeekCur = 1, SeekEnd = 2 };
+
+class File {
+public:
+  File() {}
+  File(std::vector<uint8_t>* data, bool append) : _data(data), _pos(append ? data->size() : 0) {}
+
+  operator bool() const { return _data != NULL; }
+  size_t size() const { return _data ? _data->size() : 0; }
+  size_t read(uint8_t* buffer, size_t size);
+  size_t write(const uint8_t* buffer, size_t size);
+  bool seek(uint32_t pos, SeekMode mode = SeekSet);
+  size_t position() const { return _pos; }
+  void flush() {}
+  void close() { _data = NULL; }
+
+private:
+  std::vector<uint8_t>* _data = NULL;
+  size_t _pos = 0;
+};
+
+class LittleFSClass {
+public:
+  bool begin() { return true; }
+  bool format();
+  File open(const char* path, const char* mode);
+  bool exists(const char* path);
+  bool remove(const char* path);
+  bool rename(const char* pathFrom, const char* pathTo);
+};
+
+extern LittleFSClass LittleFS;
+
+#endif // native_littlefs_h
@@ -0,0 +1,6 @@
+#ifndef native_stream_h
+#define native_stream_h
+
+#include <Arduino.h>
+
+#endif // native_stream_h
@@ -0,0 +1,44 @@
+#ifndef native_ticker_h
+#define native_ticker_h
+
+#include <functional>
+#include <Arduino.h>
+
+// Tickers fire on the virtual clock, when it is advanced.
+class Ticker {
+public:
+  typedef void (*callback_t)();
+
+  Ticker();
+  ~Ticker();
+
+  void attach_ms(uint32_t milliseconds, callback_t callback) { arm(milliseconds, true, callback); }
+  void once_ms(uint32_t milliseconds, callback_t callback) { arm(milliseconds, false, callback); }
+
+  template<typename TArg>
+  void attach_ms(uint32_t milliseconds, void (*callback)(TArg), TArg arg) {
+    arm(milliseconds, true, [callback, arg]() { callback(arg); });
+  }
+
+  template<typename TArg>
+  void once_ms(uint32_t milliseconds, void (*callback)(TArg), TArg arg) {
+    arm(milliseconds, false, [callback, arg]() { callback(arg); });
+  }
+
+  void detach() { _armed = false; }
+  bool active() const { return _armed; }
+
+  // used by the virtual clock
+  static bool fireNext(unsigned long untilMs);
+
+private:
+  void arm(uint32_t milliseconds, bool repeat, std::function<void()> callback);
+
+  std::function<void()> _callback;
+  unsigned long _periodMs = 0;
+  unsigned long _dueMs = 0;
+  bool _repeat = false;
+  bool _armed = false;
+};
+
+#endif // native_ticker_h
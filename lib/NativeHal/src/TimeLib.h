@@ -0,0 +1,51 @@
+#ifndef native_timelib_h
+#define native_timelib_h
+
+// The parts of paulstoffregen/Time used by the monitor, kept on the virtual clock.
+
+#include <stdint.h>
+#include <time.h>
+
+typedef enum { timeNotSet, timeNeedsSync, timeSet } timeStatus_t;
+typedef time_t (*getExternalTime)();
+
+typedef struct {
+  uint8_t Second;
+  uint8_t Minute;
+  uint8_t Hour;
+  uint8_t Wday;   // 1 is Sunday
+  uint8_t Day;
+  uint8_t Month;
+  uint8_t Year;   // offset from 1970
+} tmElements_t;
+
+#define CalendarYrToTm(Y) ((Y) - 1970)
+#define tmYearToCalendar(Y) ((Y) + 1970)
+
+time_t makeTime(const tmElements_t& tm);
+
+time_t now();
+void setTime(time_t t);
+void setTime(int hr, int min, int sec, int day, int month, int yr);
+void adjustTime(long adjustment);
+timeStatus_t timeStatus();
+void setSyncProvider(getExternalTime getTimeFunction);
+void setSyncInterval(time_t interval);
+
+int hour(time_t t);
+int minute(time_t t);
+int second(time_t t);
+int day(time_t t);
+int weekday(time_t t); // 1 is Sunday
+int month(time_t t);
+int year(time_t t);
+
+inline int hour() { return hour(now()); }
+inline int minute() { return minute(now()); }
+inline int second() { return second(now()); }
+inline int day() { return day(now()); }
+inline int weekday() { return weekday(now()); }
+inline int month() { return month(now()); }
+inline int year() { return year(now()); }
+
+#endif // native_timelib_h
@@ -0,0 +1,7 @@
+#ifndef native_wifiudp_h
+#define native_wifiudp_h
+
+// WiFiUDP lives with the rest of the WiFi stand-ins.
+#include <ESP8266WiFi.h>
+
+#endif // native_wifiudp_h
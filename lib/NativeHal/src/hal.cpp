@@ -0,0 +1,622 @@
+#include <Arduino.h>
+#include <Ticker.h>
+#include <TimeLib.h>
+#include <ESP8266WiFi.h>
+#include <ESP8266HTTPClient.h>
+#include <LittleFS.h>
+#include <hal.h>
+#include <errno.h>
+#include <map>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// ---- virtual clock
+
+static unsigned long virtualMs = 0;
+static uint64_t virtualUs = 0;
+
+unsigned long halMillis() {
+  return virtualMs;
+}
+
+uint64_t halMicros() {
+  return virtualUs;
+}
+
+static void setVirtualMs(unsigned long ms) {
+  virtualUs += (uint64_t)(ms - virtualMs) * 1000;
+  virtualMs = ms;
+}
+
+void halAdvanceMs(unsigned long ms) {
+  unsigned long target = virtualMs + ms;
+  while(Ticker::fireNext(target)) {
+  }
+  setVirtualMs(target);
+}
+
+unsigned long millis() {
+  return virtualMs;
+}
+
+unsigned long micros() {
+  return (unsigned long) virtualUs;
+}
+
+void delay(unsigned long ms) {
+  halAdvanceMs(ms);
+}
+
+void yield() {
+}
+
+// ---- pins
+
+static uint8_t pinValues[32];
+static HalAnalogSource analogSource = NULL;
+static HalDigitalWriteHook digitalWriteHook = NULL;
+
+void halSetAnalogSource(HalAnalogSource source) {
+  analogSource = source;
+}
+
+void halSetDigitalWriteHook(HalDigitalWriteHook hook) {
+  digitalWriteHook = hook;
+}
+
+uint8_t halDigitalValue(uint8_t pin) {
+  return pin < sizeof(pinValues) ? pinValues[pin] : 0;
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+  if(pin < sizeof(pinValues)) {
+    pinValues[pin] = value;
+  }
+  if(digitalWriteHook != NULL) {
+    digitalWriteHook(pin, value);
+  }
+}
+
+int digitalRead(uint8_t pin) {
+  return halDigitalValue(pin);
+}
+
+int analogRead(uint8_t pin) {
+  return analogSource != NULL ? analogSource(pin) : 0;
+}
+
+// ---- Ticker
+
+// Tickers are often globals, so the registry must exist before any of them is constructed.
+static std::vector<Ticker*>& tickerRegistry() {
+  static std::vector<Ticker*> tickers;
+  return tickers;
+}
+
+Ticker::Ticker() {
+  tickerRegistry().push_back(this);
+}
+
+Ticker::~Ticker() {
+  std::vector<Ticker*>& tickers = tickerRegistry();
+  tickers.erase(std::remove(tickers.begin(), tickers.end(), this), tickers.end());
+}
+
+void Ticker::arm(uint32_t milliseconds, bool repeat, std::function<void()> callback) {
+  _callback = callback;
+  _periodMs = milliseconds > 0 ? milliseconds : 1;
+  _dueMs = virtualMs + _periodMs;
+  _repeat = repeat;
+  _armed = true;
+}
+
+// Fires the earliest Ticker due by untilMs, moving the clock to its time.
+bool Ticker::fireNext(unsigned long untilMs) {
+  Ticker* next = NULL;
+  for(Ticker* t : tickerRegistry()) {
+    if(t->_armed && (long)(untilMs - t->_dueMs) >= 0 && (next == NULL || (long)(next->_dueMs - t->_dueMs) > 0)) {
+      next = t;
+    }
+  }
+  if(next == NULL) {
+    return false;
+  }
+
+  if((long)(next->_dueMs - virtualMs) > 0) {
+    setVirtualMs(next->_dueMs);
+  }
+  if(next->_repeat) {
+    next->_dueMs += next->_periodMs;
+  }
+  else {
+    next->_armed = false;
+  }
+  std::function<void()> callback = next->_callback;
+  callback();
+  return true;
+}
+
+// ---- TimeLib
+
+static time_t timeBase = 0;          // time at timeBaseMs
+static unsigned long timeBaseMs = 0;
+static timeStatus_t timeState = timeNotSet;
+static getExternalTime syncProvider = NULL;
+static unsigned long syncIntervalMs = 300 * 1000;
+static unsigned long nextSyncMs = 0;
+
+// Like TimeLib: the provider is asked again once the interval is over,
+// and a 0 answer leaves the time running but flags it as needing a sync.
+time_t now() {
+  if(syncProvider != NULL && (long)(virtualMs - nextSyncMs) >= 0) {
+    time_t t = syncProvider();
+    if(t != 0) {
+      setTime(t);
+    }
+    else {
+      nextSyncMs = virtualMs + syncIntervalMs;
+      timeState = (timeState == timeNotSet) ? timeNotSet : timeNeedsSync;
+    }
+  }
+  return timeBase + (time_t)((virtualMs - timeBaseMs) / 1000);
+}
+
+void setTime(time_t t) {
+  timeBase = t;
+  timeBaseMs = virtualMs;
+  timeState = timeSet;
+  nextSyncMs = virtualMs + syncIntervalMs;
+}
+
+void setTime(int hr, int min, int sec, int dy, int mnth, int yr) {
+  struct tm tm = {};
+  tm.tm_year = yr - 1900;
+  tm.tm_mon = mnth - 1;
+  tm.tm_mday = dy;
+  tm.tm_hour = hr;
+  tm.tm_min = min;
+  tm.tm_sec = sec;
+  setTime(timegm(&tm));
+}
+
+time_t makeTime(const tmElements_t& te) {
+  struct tm tm = {};
+  tm.tm_year = tmYearToCalendar(te.Year) - 1900;
+  tm.tm_mon = te.Month - 1;
+  tm.tm_mday = te.Day;
+  tm.tm_hour = te.Hour;
+  tm.tm_min = te.Minute;
+  tm.tm_sec = te.Second;
+  return timegm(&tm);
+}
+
+void adjustTime(long adjustment) {
+  timeBase += adjustment;
+}
+
+timeStatus_t timeStatus() {
+  now();
+  return timeState;
+}
+
+void setSyncProvider(getExternalTime getTimeFunction) {
+  syncProvider = getTimeFunction;
+  nextSyncMs = virtualMs;
+  now();
+}
+
+void setSyncInterval(time_t interval) {
+  syncIntervalMs = interval * 1000;
+  nextSyncMs = virtualMs + syncIntervalMs;
+}
+
+static struct tm breakTime(time_t t) {
+  struct tm tm;
+  gmtime_r(&t, &tm);
+  return tm;
+}
+
+int hour(time_t t) { return breakTime(t).tm_hour; }
+int minute(time_t t) { return breakTime(t).tm_min; }
+int second(time_t t) { return breakTime(t).tm_sec; }
+int day(time_t t) { return breakTime(t).tm_mday; }
+int weekday(time_t t) { return breakTime(t).tm_wday + 1; }
+int month(time_t t) { return breakTime(t).tm_mon + 1; }
+int year(time_t t) { return breakTime(t).tm_year + 1900; }
+
+// ---- Serial, Stream, ESP
+
+HardwareSerial Serial;
+EspClass ESP;
+static bool serialOutput = true;
+
+void halSetSerialOutput(bool enabled) {
+  serialOutput = enabled;
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+  if(serialOutput) {
+    fputc(c, stdout);
+  }
+  return 1;
+}
+
+size_t HardwareSerial::write(const uint8_t* buffer, size_t size) {
+  if(serialOutput) {
+    fwrite(buffer, 1, size, stdout);
+  }
+  return size;
+}
+
+size_t Print::printf(const char* format, ...) {
+  char buff[1024];
+  va_list args;
+  va_start(args, format);
+  int len = vsnprintf(buff, sizeof(buff), format, args);
+  va_end(args);
+  return write((const uint8_t*) buff, min((size_t) len, sizeof(buff) - 1));
+}
+
+size_t Stream::readBytes(char* buffer, size_t length) {
+  size_t n = 0;
+  while(n < length) {
+    int c = read();
+    if(c < 0) {
+      break;
+    }
+    buffer[n++] = (char) c;
+  }
+  return n;
+}
+
+static uint32_t rtcMemory[128];
+
+bool EspClass::rtcUserMemoryRead(uint32_t offset, uint32_t* data, size_t size) {
+  if(offset * 4 + size > sizeof(rtcMemory)) {
+    return false;
+  }
+  memcpy(data, (uint8_t*) rtcMemory + offset * 4, size);
+  return true;
+}
+
+bool EspClass::rtcUserMemoryWrite(uint32_t offset, uint32_t* data, size_t size) {
+  if(offset * 4 + size > sizeof(rtcMemory)) {
+    return false;
+  }
+  memcpy((uint8_t*) rtcMemory + offset * 4, data, size);
+  return true;
+}
+
+void EspClass::restart() {
+  fprintf(stderr, "ESP.restart() called\n");
+  exit(1);
+}
+
+// ---- LittleFS
+
+LittleFSClass LittleFS;
+static std::map<std::string, std::vector<uint8_t>> files;
+
+size_t File::read(uint8_t* buffer, size_t size) {
+  size_t len = _data ? min(size, _data->size() - _pos) : 0;
+  if(len > 0) {
+    memcpy(buffer, _data->data() + _pos, len);
+    _pos += len;
+  }
+  return len;
+}
+
+size_t File::write(const uint8_t* buffer, size_t size) {
+  if(!_data) {
+    return 0;
+  }
+  _data->resize(max(_data->size(), _pos + size));
+  memcpy(_data->data() + _pos, buffer, size);
+  _pos += size;
+  return size;
+}
+
+bool File::seek(uint32_t pos, SeekMode mode) {
+  size_t base = mode == SeekSet ? 0 : mode == SeekCur ? _pos : size();
+  if(!_data || base + pos > _data->size()) {
+    return false;
+  }
+  _pos = base + pos;
+  return true;
+}
+
+bool LittleFSClass::format() {
+  files.clear();
+  return true;
+}
+
+File LittleFSClass::open(const char* path, const char* mode) {
+  auto file = files.find(path);
+  if(mode[0] == 'r') {
+    return file == files.end() ? File() : File(&file->second, false);
+  }
+  std::vector<uint8_t>& data = files[path];
+  if(mode[0] == 'w') {
+    data.clear();
+  }
+  return File(&data, mode[0] == 'a');
+}
+
+bool LittleFSClass::exists(const char* path) {
+  return files.count(path) > 0;
+}
+
+bool LittleFSClass::remove(const char* path) {
+  return files.erase(path) > 0;
+}
+
+bool LittleFSClass::rename(const char* pathFrom, const char* pathTo) {
+  auto file = files.find(pathFrom);
+  if(file == files.end()) {
+    return false;
+  }
+  files[pathTo] = std::move(file->second);
+  files.erase(pathFrom);
+  return true;
+}
+
+// ---- WiFi
+
+ESP8266WiFiClass WiFi;
+static bool wifiConnected = true;
+static uint8_t bssid[6] = { 0x02, 0, 0, 0, 0, 0x01 };
+
+void halSetWiFiConnected(bool connected) {
+  wifiConnected = connected;
+}
+
+wl_status_t ESP8266WiFiClass::status() {
+  return wifiConnected ? WL_CONNECTED : WL_DISCONNECTED;
+}
+
+wl_status_t ESP8266WiFiClass::begin(const char* ssid, const char* passphrase, int32_t channel, const uint8_t* bssid, bool connect) {
+  return status();
+}
+
+bool ESP8266WiFiClass::disconnect(bool wifiOff) {
+  return true;
+}
+
+uint8_t* ESP8266WiFiClass::BSSID() {
+  return bssid;
+}
+
+int WiFiClient::connect(IPAddress ip, uint16_t port) {
+  char host[16];
+  snprintf(host, sizeof(host), "%d.%d.%d.%d", ip[0], ip[1], ip[2], ip[3]);
+  return connect(host, port);
+}
+
+int WiFiClient::connect(const char* host, uint16_t port) {
+  stop();
+  if(!wifiConnected) {
+    return 0;
+  }
+
+  addrinfo hints = {};
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* addr = NULL;
+  char service[8];
+  snprintf(service, sizeof(service), "%u", port);
+  if(getaddrinfo(host, service, &hints, &addr) != 0) {
+    return 0;
+  }
+  _fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+  if(_fd < 0 || ::connect(_fd, addr->ai_addr, addr->ai_addrlen) != 0) {
+    freeaddrinfo(addr);
+    stop();
+    return 0;
+  }
+  freeaddrinfo(addr);
+  fcntl(_fd, F_SETFL, O_NONBLOCK);
+  _connected = true;
+  return 1;
+}
+
+uint8_t WiFiClient::connected() {
+  if(_fd < 0) {
+    return _connected;
+  }
+  char c;
+  ssize_t n = recv(_fd, &c, 1, MSG_PEEK);
+  if(n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+    stop();
+  }
+  return _connected;
+}
+
+void WiFiClient::stop() {
+  if(_fd >= 0) {
+    ::close(_fd);
+    _fd = -1;
+  }
+  _connected = false;
+}
+
+size_t WiFiClient::write(const uint8_t* buffer, size_t size) {
+  if(_fd < 0) {
+    return _connected ? size : 0;
+  }
+  size_t sent = 0;
+  while(sent < size) {
+    ssize_t n = ::send(_fd, buffer + sent, size - sent, MSG_NOSIGNAL);
+    if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      continue;
+    }
+    if(n <= 0) {
+      stop();
+      break;
+    }
+    sent += n;
+  }
+  return sent;
+}
+
+// Polling an idle socket takes some time on the device too; this also keeps
+// clients that wait for data with millis() timeouts from spinning forever.
+int WiFiClient::available() {
+  if(_fd < 0) {
+    return 0;
+  }
+  int count = 0;
+  if(ioctl(_fd, FIONREAD, &count) != 0 || count == 0) {
+    halAdvanceMs(1);
+    return 0;
+  }
+  return count;
+}
+
+int WiFiClient::read() {
+  uint8_t c;
+  return read(&c, 1) == 1 ? c : -1;
+}
+
+int WiFiClient::read(uint8_t* buffer, size_t size) {
+  if(_fd < 0) {
+    return -1;
+  }
+  ssize_t n = recv(_fd, buffer, size, 0);
+  return n > 0 ? (int) n : -1;
+}
+
+int WiFiClient::peek() {
+  uint8_t c;
+  if(_fd < 0 || recv(_fd, &c, 1, MSG_PEEK) != 1) {
+    return -1;
+  }
+  return c;
+}
+
+int WiFiUDP::beginPacket(const char* host, uint16_t port) { return 0; }
+int WiFiUDP::beginPacket(IPAddress ip, uint16_t port) { return 0; }
+size_t WiFiUDP::write(const uint8_t* buffer, size_t size) { return 0; }
+int WiFiUDP::endPacket() { return 0; }
+int WiFiUDP::parsePacket() { return 0; }
+int WiFiUDP::read(uint8_t* buffer, size_t size) { return 0; }
+
+// ---- HTTP
+
+static time_t serverTime = 1767268800; // 2026-01-01 12:00:00
+static unsigned long httpLatencyMs = 20;
+static std::string configBody = "{}";
+static FILE* logDump = NULL;
+
+void halSetConfigBody(const char* json) {
+  configBody = json;
+}
+
+void halSetLogDump(FILE* file) {
+  logDump = file;
+}
+
+void halSetServerTime(time_t epoch) {
+  serverTime = epoch - virtualMs / 1000;
+}
+
+void halSetHttpLatencyMs(unsigned long latencyMs) {
+  httpLatencyMs = latencyMs;
+}
+
+// Answers the config pull with the set config and the server time, and accepts all posts.
+static void defaultHttpHandler(const HalHttpRequest& request, HalHttpResponse& response) {
+  response.Code = 200;
+  if(request.Method == "GET" && request.Url.find("/config") != std::string::npos) {
+    char localTime[20];
+    time_t t = serverTime + virtualMs / 1000;
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    strftime(localTime, sizeof(localTime), "%Y%m%d%H%M%S", &tm);
+    response.Headers.push_back({ "X-IoT-LocalTime", localTime });
+    response.Body = configBody;
+  }
+  else if(request.Method == "POST" && request.Url.find("/log") != std::string::npos && logDump != NULL) {
+    fwrite(request.Body.data(), 1, request.Body.size(), logDump);
+    fflush(logDump);
+  }
+}
+
+static HalHttpHandler httpHandler = defaultHttpHandler;
+
+void halSetHttpHandler(HalHttpHandler handler) {
+  httpHandler = handler != NULL ? handler : defaultHttpHandler;
+}
+
+bool HTTPClient::begin(WiFiClient& client, const char* url) {
+  _client = &client;
+  _request = HalHttpRequest();
+  _request.Url = url;
+  _response = HalHttpResponse();
+  return true;
+}
+
+void HTTPClient::end() {
+  if(_client != NULL && !_reuse) {
+    _client->stop();
+  }
+}
+
+void HTTPClient::addHeader(const String& name, const String& value, bool first, bool replace) {
+  _request.Headers.push_back({ name.c_str(), value.c_str() });
+}
+
+void HTTPClient::collectHeaders(const char* headerKeys[], const size_t headerKeysCount) {
+  _collect.assign(headerKeys, headerKeys + headerKeysCount);
+}
+
+String HTTPClient::header(const char* name) {
+  for(auto& h : _response.Headers) {
+    if(strcasecmp(h.first.c_str(), name) == 0) {
+      return String(h.second);
+    }
+  }
+  return String();
+}
+
+bool HTTPClient::hasHeader(const char* name) {
+  for(auto& h : _response.Headers) {
+    if(strcasecmp(h.first.c_str(), name) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+int HTTPClient::GET() {
+  return sendRequest("GET", NULL, 0);
+}
+
+int HTTPClient::POST(const uint8_t* payload, size_t size) {
+  return sendRequest("POST", payload, size);
+}
+
+int HTTPClient::sendRequest(const char* type, const uint8_t* payload, size_t size) {
+  if(!wifiConnected) {
+    return HTTPC_ERROR_CONNECTION_FAILED;
+  }
+  if(!_client->connected()) {
+    _client->setConnected(true);
+  }
+
+  _request.Method = type;
+  _request.Body.assign((const char*) payload, payload != NULL ? size : 0);
+  delay(httpLatencyMs);
+  httpHandler(_request, _response);
+  return _response.Code;
+}
+
+int HTTPClient::writeToStream(Stream* stream) {
+  size_t written = stream->write((const uint8_t*) _response.Body.data(), _response.Body.size());
+  return written == _response.Body.size() ? (int) written : HTTPC_ERROR_STREAM_WRITE;
+}
@@ -0,0 +1,53 @@
+#ifndef native_hal_h
+#define native_hal_h
+
+// Control of the simulated hardware for the native build.
+// Time is virtual: it only moves when delay() is called or the simulation advances it.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <utility>
+
+unsigned long halMillis();
+void halAdvanceMs(unsigned long ms);   // moves the clock, firing Tickers as their time comes
+uint64_t halMicros();
+
+typedef int (*HalAnalogSource)(uint8_t pin);
+typedef void (*HalDigitalWriteHook)(uint8_t pin, uint8_t value);
+void halSetAnalogSource(HalAnalogSource source);
+void halSetDigitalWriteHook(HalDigitalWriteHook hook);
+uint8_t halDigitalValue(uint8_t pin);
+
+void halSetWiFiConnected(bool connected);
+
+struct HalHttpRequest {
+  std::string Method;
+  std::string Url;
+  std::string Body;
+  std::vector<std::pair<std::string, std::string>> Headers;
+};
+
+struct HalHttpResponse {
+  int Code = 200;
+  std::string Body;
+  std::vector<std::pair<std::string, std::string>> Headers;
+};
+
+typedef void (*HalHttpHandler)(const HalHttpRequest& request, HalHttpResponse& response);
+void halSetHttpHandler(HalHttpHandler handler);
+void halSetHttpLatencyMs(unsigned long latencyMs);
+
+// Server side wall clock for the default http handler, seconds since 1970 UTC.
+void halSetServerTime(time_t epoch);
+
+// Config served to the firmware by the default http handler, "{}" by default.
+void halSetConfigBody(const char* json);
+// Bodies of the log posts are appended to the file, text or binary.
+void halSetLogDump(FILE* file);
+
+void halSetSerialOutput(bool enabled);
+
+#endif // native_hal_h
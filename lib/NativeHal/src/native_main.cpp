@@ -0,0 +1,195 @@
+#include <Arduino.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <hal.h>
+#include <replay.h>
+#include <main.h>
+#include <pins.h>
+
+// Runs the unchanged firmware setup() and loop() on the virtual clock, with a simple door model.
+//
+// Usage: program [--days N] [--step-ms N] [--open-at-min M]... [--config JSON] [--log-dump FILE] [--realtime] [--verbose]
+//        program --replay TRACE [--step-ms N] [--min-run-ms N] [--debounce-count N] [--debounce-pause-ms N] [--verbose]
+//   --days N          simulated time, 1 day by default
+//   --step-ms N       virtual time between loop() passes, 10 ms by default
+//   --open-at-min M   someone opens the door M minutes into the simulation (repeatable),
+//                     M:D opens door D of a DOOR_COUNT 2 build
+//   --config JSON     config served to the firmware, e.g. '{"DebugLog":true}'
+//   --log-dump FILE   write the posted log batches to FILE, see tools/logdecode.py for LOG_BINARY builds
+//   --replay TRACE    feed a recorded position sensor trace instead of the door model, see replay.cpp
+//   --realtime        run the virtual clock at wall clock speed, e.g. to query the status server
+//   --verbose         show the firmware's serial output
+
+void setup();
+void loop();
+
+#define SIM_DOOR_TRAVEL_MS  12000
+#define SIM_VALUE_OPEN      1000
+#define SIM_VALUE_CLOSED    500
+#define SIM_VALUE_AJAR      50
+
+struct SimDoor {
+  int State = DOOR_CLOSED;
+  int Target = DOOR_CLOSED;
+  unsigned long MoveStartMs = 0;
+  int Activations = 0;
+
+  void toggle() {
+    Target = (State == DOOR_CLOSED || Target == DOOR_CLOSED) ? DOOR_OPEN : DOOR_CLOSED;
+    State = DOOR_AJAR;
+    MoveStartMs = millis();
+  }
+
+  int read() {
+    if(State == DOOR_AJAR && millis() - MoveStartMs >= SIM_DOOR_TRAVEL_MS) {
+      State = Target;
+    }
+    switch(State) {
+      case DOOR_OPEN: return SIM_VALUE_OPEN;
+      case DOOR_CLOSED: return SIM_VALUE_CLOSED;
+      default: return SIM_VALUE_AJAR;
+    }
+  }
+} simDoors[DOOR_COUNT];
+
+struct SimOpen {
+  unsigned long AtMs;
+  int Door;
+};
+
+int simAnalogRead(uint8_t pin) {
+  if(pin != POSITION_PIN) {
+    return 0;
+  }
+#if DOOR_COUNT > 1
+  return simDoors[halDigitalValue(SENSOR_SELECT_PIN) ? 1 : 0].read();
+#else
+  return simDoors[0].read();
+#endif
+}
+
+void simDigitalWrite(uint8_t pin, uint8_t value) {
+  int door = pin == GDOOR_PIN ? 0 : pin == GDOOR2_PIN ? 1 : -1;
+  if(0 <= door && door < DOOR_COUNT && value == HIGH) {
+    simDoors[door].Activations++;
+    simDoors[door].toggle();
+  }
+}
+
+int main(int argc, char* argv[]) {
+  unsigned long days = 1;
+  unsigned long stepMs = 10;
+  std::vector<SimOpen> openAt;
+  bool verbose = false;
+  bool realtime = false;
+  FILE* logDump = NULL;
+  ReplayOptions replay;
+
+  for(int n = 1; n < argc; n++) {
+    if(0 == strcmp(argv[n], "--days") && n + 1 < argc) {
+      days = strtoul(argv[++n], NULL, 10);
+    }
+    else if(0 == strcmp(argv[n], "--step-ms") && n + 1 < argc) {
+      stepMs = max(1UL, strtoul(argv[++n], NULL, 10));
+    }
+    else if(0 == strcmp(argv[n], "--open-at-min") && n + 1 < argc) {
+      char* end;
+      unsigned long atMs = strtoul(argv[++n], &end, 10) * 60 * 1000;
+      int door = ':' == *end ? atoi(end + 1) : 0;
+      if(door < 0 || door >= DOOR_COUNT) {
+        fprintf(stderr, "No door %d, built for %d door(s).\n", door, DOOR_COUNT);
+        return 2;
+      }
+      openAt.push_back({ atMs, door });
+    }
+    else if(0 == strcmp(argv[n], "--config") && n + 1 < argc) {
+      halSetConfigBody(argv[++n]);
+    }
+    else if(0 == strcmp(argv[n], "--log-dump") && n + 1 < argc) {
+      logDump = fopen(argv[++n], "wb");
+      if(NULL == logDump) {
+        perror(argv[n]);
+        return 2;
+      }
+      halSetLogDump(logDump);
+    }
+    else if(0 == strcmp(argv[n], "--replay") && n + 1 < argc) {
+      replay.TracePath = argv[++n];
+    }
+    else if(0 == strcmp(argv[n], "--min-run-ms") && n + 1 < argc) {
+      replay.MinRunMs = strtoul(argv[++n], NULL, 10);
+    }
+    else if(0 == strcmp(argv[n], "--debounce-count") && n + 1 < argc) {
+      replay.DebounceReadCount = atoi(argv[++n]);
+    }
+    else if(0 == strcmp(argv[n], "--debounce-pause-ms") && n + 1 < argc) {
+      replay.DebounceReadPauseMs = atoi(argv[++n]);
+    }
+    else if(0 == strcmp(argv[n], "--realtime")) {
+      realtime = true;
+    }
+    else if(0 == strcmp(argv[n], "--verbose")) {
+      verbose = true;
+    }
+    else {
+      fprintf(stderr, "Unknown argument: %s\n", argv[n]);
+      return 2;
+    }
+  }
+
+  if(replay.TracePath != NULL) {
+    replay.StepMs = stepMs;
+    replay.Verbose = verbose;
+    return runReplay(replay);
+  }
+
+  halSetSerialOutput(verbose);
+  halSetAnalogSource(simAnalogRead);
+  halSetDigitalWriteHook(simDigitalWrite);
+
+  auto wallStart = std::chrono::steady_clock::now();
+  setup();
+
+  unsigned long endMs = days * 24 * 60 * 60 * 1000;
+  unsigned long passes = 0;
+  unsigned long maxBlockedMs = 0;   // virtual time spent inside one loop() pass
+  uint64_t maxPassNs = 0;           // host time of one loop() pass
+  size_t nextOpen = 0;
+
+  while(millis() < endMs) {
+    while(nextOpen < openAt.size() && millis() >= openAt[nextOpen].AtMs) {
+      SimDoor& simDoor = simDoors[openAt[nextOpen].Door];
+      if(simDoor.State == DOOR_CLOSED) {
+        simDoor.toggle();
+      }
+      nextOpen++;
+    }
+
+    unsigned long passStartMs = millis();
+    auto passStart = std::chrono::steady_clock::now();
+    loop();
+    uint64_t passNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - passStart).count();
+
+    maxBlockedMs = max(maxBlockedMs, millis() - passStartMs);
+    maxPassNs = max(maxPassNs, passNs);
+    passes++;
+    if(realtime) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(stepMs));
+    }
+    halAdvanceMs(stepMs);
+  }
+
+  double wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - wallStart).count();
+  printf("Simulated %lu day(s) in %.0f ms.\n", days, wallMs);
+  printf("Loop passes: %lu, longest pass: %lu ms virtual, %.1f us host.\n", passes, maxBlockedMs, maxPassNs / 1000.0);
+  for(int door = 0; door < DOOR_COUNT; door++) {
+    const SimDoor& simDoor = simDoors[door];
+    printf("Door %d activations: %d, door is %s.\n", door, simDoor.Activations, simDoor.State == DOOR_CLOSED ? "closed" : simDoor.State == DOOR_OPEN ? "open" : "ajar");
+  }
+  printf("Http requests: %lu, reused: %lu, failed: %lu, bytes sent: %lu.\n", IotHttpStats.Requests, IotHttpStats.Reused, IotHttpStats.Failures, IotHttpStats.BytesSent);
+  if(logDump != NULL) {
+    fclose(logDump);
+  }
+  return 0;
+}
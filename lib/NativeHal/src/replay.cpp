@@ -0,0 +1,259 @@
+#include <Arduino.h>
+#include <time.h>
+#include <vector>
+#include <hal.h>
+#include <replay.h>
+#include <main.h>
+#include <pins.h>
+
+// Traces are recorded with LogRawSensor set in the config: every sample of the position sensor,
+// logged as "millis,value" pairs
+//   2026-01-01 12:00:05 Raw sensor door 0: 65000,512 65100,511 65200,513
+// The debug log's position lines are read too, but they carry the filtered value once per door
+// check, too coarse to measure the debounce with
+//   2026-01-01 12:00:05 Position pin (17) value: 512, door 0
+//   0.00:01:05.100 Position pin (17) value: 512
+// and so are plain "milliseconds,value" lines. Everything else is skipped, lines of other doors too.
+
+void setup();
+void loop();
+
+struct TraceSample {
+  unsigned long Ms;   // since the first sample
+  int Value;
+};
+
+struct Transition {
+  unsigned long Ms;
+  int State;
+  unsigned long Reads; // analog reads so far
+};
+
+std::vector<TraceSample> trace;
+size_t traceNdx = 0;
+unsigned long replayReads = 0;
+int replayCloseDecisions = 0;
+
+int replayAnalogRead(uint8_t pin) {
+  if(pin != POSITION_PIN || trace.empty()) {
+    return 0;
+  }
+  while(traceNdx + 1 < trace.size() && trace[traceNdx + 1].Ms <= millis()) {
+    traceNdx++;
+  }
+  replayReads++;
+  return trace[traceNdx].Value;
+}
+
+void replayDigitalWrite(uint8_t pin, uint8_t value) {
+  if(pin == GDOOR_PIN && value == HIGH) {
+    replayCloseDecisions++;
+  }
+}
+
+// Returns milliseconds, -1 if the line has no sample. startEpoch is set by the first wall clock timestamp.
+long long parseTraceLine(const char* line, int& value, time_t& startEpoch) {
+  int y, mo, d, h, mi, s, ms;
+  const char* pos = strstr(line, "Position pin");
+  if(pos == NULL) {
+    long long t;
+    return (sscanf(line, "%lld,%d", &t, &value) == 2) ? t : -1;
+  }
+  const char* val = strstr(pos, "value:");
+  int door = 0;
+  if(val == NULL || sscanf(val, "value: %d, door %d", &value, &door) < 1 || door != 0) {
+    return -1;
+  }
+
+  if(sscanf(line, "%4d-%2d-%2d %2d:%2d:%2d", &y, &mo, &d, &h, &mi, &s) == 6) {
+    struct tm tm = {};
+    tm.tm_year = y - 1900;
+    tm.tm_mon = mo - 1;
+    tm.tm_mday = d;
+    tm.tm_hour = h;
+    tm.tm_min = mi;
+    tm.tm_sec = s;
+    time_t t = timegm(&tm);
+    if(startEpoch == 0) {
+      startEpoch = t;
+    }
+    return (long long)(t - startEpoch) * 1000;
+  }
+  if(sscanf(line, "%d.%2d:%2d:%2d.%3d", &d, &h, &mi, &s, &ms) == 5) {
+    return (((long long) d * 24 + h) * 60 + mi) * 60000LL + s * 1000LL + ms;
+  }
+  return -1;
+}
+
+void addTraceSample(long long t, int value, long long& firstMs) {
+  if(firstMs < 0) {
+    firstMs = t;
+  }
+  if(t - firstMs < (trace.empty() ? 0 : (long long) trace.back().Ms)) {
+    return; // out of order
+  }
+  trace.push_back({ (unsigned long)(t - firstMs), value });
+}
+
+// Returns false if the line is not a raw sample line.
+bool parseRawTraceLine(const char* line, long long& firstMs) {
+  const char* pos = strstr(line, "Raw sensor door ");
+  int door, n;
+  if(pos == NULL || sscanf(pos, "Raw sensor door %d:%n", &door, &n) < 1) {
+    return false;
+  }
+  long long t;
+  int value, len;
+  for(pos += n; door == 0 && sscanf(pos, " %lld,%d%n", &t, &value, &len) == 2; pos += len) {
+    addTraceSample(t, value, firstMs);
+  }
+  return true;
+}
+
+bool loadTrace(const char* path, time_t& startEpoch) {
+  FILE* f = fopen(path, "r");
+  if(f == NULL) {
+    fprintf(stderr, "Cannot open trace %s\n", path);
+    return false;
+  }
+
+  char line[1024];
+  long long firstMs = -1;
+  while(fgets(line, sizeof(line), f) != NULL) {
+    if(parseRawTraceLine(line, firstMs)) {
+      continue;
+    }
+    int value;
+    long long t = parseTraceLine(line, value, startEpoch);
+    if(t >= 0) {
+      addTraceSample(t, value, firstMs);
+    }
+  }
+  fclose(f);
+  return !trace.empty();
+}
+
+int classifyTraceValue(int value) {
+  for(int ds = 0; ds < DOOR_STATE_COUNT; ds++) {
+    if(AppConfig.Doors[0].SensorRangeValues[ds][0] <= value && value <= AppConfig.Doors[0].SensorRangeValues[ds][1]) {
+      return ds;
+    }
+  }
+  return DOOR_UNKNOWN;
+}
+
+// The real transitions: changes to a state that then holds for at least minRunMs.
+std::vector<Transition> findTraceTransitions(unsigned long minRunMs) {
+  std::vector<Transition> result;
+  int current = DOOR_UNKNOWN;
+  for(size_t n = 0; n < trace.size(); ) {
+    int state = classifyTraceValue(trace[n].Value);
+    size_t end = n + 1;
+    while(end < trace.size() && classifyTraceValue(trace[end].Value) == state) {
+      end++;
+    }
+    unsigned long runEndMs = end < trace.size() ? trace[end].Ms : trace.back().Ms + 1;
+    if(state != DOOR_UNKNOWN && state != current && runEndMs - trace[n].Ms >= minRunMs) {
+      // the first one is the initial state, present from the start
+      result.push_back({ result.empty() ? trace.front().Ms : trace[n].Ms, state, 0 });
+      current = state;
+    }
+    n = end;
+  }
+  return result;
+}
+
+int runReplay(const ReplayOptions& options) {
+  time_t startEpoch = 0;
+  if(!loadTrace(options.TracePath, startEpoch)) {
+    fprintf(stderr, "No samples in %s\n", options.TracePath);
+    return 1;
+  }
+  if(startEpoch != 0) {
+    halSetServerTime(startEpoch);
+  }
+
+  halSetSerialOutput(options.Verbose);
+  halSetAnalogSource(replayAnalogRead);
+  halSetDigitalWriteHook(replayDigitalWrite);
+
+  setup();
+  if(options.DebounceReadCount > 0) {
+    AppConfig.DebounceReadCount = options.DebounceReadCount;
+  }
+  if(options.DebounceReadPauseMs > 0) {
+    AppConfig.DebounceReadPauseMs = options.DebounceReadPauseMs;
+  }
+
+  // trace time starts at the end of setup()
+  unsigned long startMs = millis();
+  for(TraceSample& sample : trace) {
+    sample.Ms += startMs;
+  }
+  std::vector<Transition> actual = findTraceTransitions(options.MinRunMs);
+
+  std::vector<Transition> detected;
+  std::vector<unsigned long> readsAt; // analog reads when each actual transition happened
+  size_t nextActual = 0;
+  int lastState = DOOR_UNKNOWN;
+  unsigned long endMs = trace.back().Ms + 60 * 1000;
+  while(millis() < endMs) {
+    while(nextActual < actual.size() && actual[nextActual].Ms <= millis()) {
+      actual[nextActual++].Reads = replayReads;
+    }
+
+    loop();
+    int state = getDoorState(0);
+    if(state >= 0 && state != lastState) {
+      detected.push_back({ millis(), state, replayReads });
+      lastState = state;
+    }
+    halAdvanceMs(options.StepMs);
+  }
+
+  // match each actual transition with the first detection of its state, before the next transition
+  char duration[24];
+  printf("Trace %s: %zu samples over %s.\n", options.TracePath, trace.size(), formatMillis(duration, trace.back().Ms - startMs));
+  printf("%-16s %-8s %12s %14s\n", "at", "to", "latency ms", "debounce reads");
+  std::vector<bool> matched(detected.size(), false);
+  unsigned long totalLatency = 0, maxLatency = 0, totalReads = 0;
+  int found = 0, missed = 0;
+  for(size_t a = 0; a < actual.size(); a++) {
+    unsigned long untilMs = a + 1 < actual.size() ? actual[a + 1].Ms : endMs;
+    char at[24];
+    formatMillis(at, actual[a].Ms - startMs);
+    size_t d = 0;
+    for(; d < detected.size(); d++) {
+      if(!matched[d] && detected[d].State == actual[a].State && detected[d].Ms >= actual[a].Ms && detected[d].Ms < untilMs) {
+        break;
+      }
+    }
+    if(d == detected.size()) {
+      printf("%-16s %-8s %12s %14s\n", at, getNamedDoorState(actual[a].State), "missed", "-");
+      missed++;
+      continue;
+    }
+    matched[d] = true;
+    unsigned long latency = detected[d].Ms - actual[a].Ms;
+    unsigned long reads = detected[d].Reads - actual[a].Reads;
+    printf("%-16s %-8s %12lu %14lu\n", at, getNamedDoorState(actual[a].State), latency, reads);
+    totalLatency += latency;
+    totalReads += reads;
+    maxLatency = max(maxLatency, latency);
+    found++;
+  }
+
+  int falseTransitions = 0;
+  for(size_t d = 0; d < detected.size(); d++) {
+    if(!matched[d]) {
+      falseTransitions++;
+    }
+  }
+
+  printf("Transitions: %zu, detected: %d, missed: %d, false: %d.\n", actual.size(), found, missed, falseTransitions);
+  if(found > 0) {
+    printf("Latency avg: %lu ms, max: %lu ms. Debounce reads avg: %lu.\n", totalLatency / found, maxLatency, totalReads / found);
+  }
+  printf("Close decisions: %d. Analog reads: %lu.\n", replayCloseDecisions, replayReads);
+  return 0;
+}
@@ -0,0 +1,18 @@
+#ifndef native_replay_h
+#define native_replay_h
+
+// Replays a recorded position sensor trace through the firmware and reports
+// how well door transitions are detected.
+
+struct ReplayOptions {
+  const char* TracePath = NULL;
+  unsigned long StepMs = 10;
+  unsigned long MinRunMs = 1000;   // a reading must hold this long to count as a real transition
+  int DebounceReadCount = -1;      // overrides of the firmware config, -1 keeps it
+  int DebounceReadPauseMs = -1;
+  bool Verbose = false;
+};
+
+int runReplay(const ReplayOptions& options);
+
+#endif // native_replay_h
@@ -0,0 +1,9 @@
+#ifndef sensitive_h
+#define sensitive_h
+
+// Placeholders for the native build. The device build uses the real include/sensitive.h.
+#define WIFI_NETWORK      "native"
+#define WIFI_PASSWORD     "native"
+#define IOT_SERVICE_FQDN  "localhost"
+
+#endif // sensitive_h
@@ -0,0 +1,91 @@
+#include <ESP8266WebServer.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+void ESP8266WebServer::begin() {
+  _listenFd = socket(AF_INET, SOCK_STREAM, 0);
+  int yes = 1;
+  setsockopt(_listenFd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(_port);
+  if(bind(_listenFd, (sockaddr*) &addr, sizeof(addr)) != 0 || listen(_listenFd, 4) != 0) {
+    fprintf(stderr, "Web server can't listen on port %d\n", _port);
+    close();
+    return;
+  }
+  fcntl(_listenFd, F_SETFL, O_NONBLOCK);
+}
+
+void ESP8266WebServer::close() {
+  if(_listenFd >= 0) {
+    ::close(_listenFd);
+    _listenFd = -1;
+  }
+}
+
+// Serves at most one waiting client; returns right away if there is none.
+void ESP8266WebServer::handleClient() {
+  if(_listenFd < 0) {
+    return;
+  }
+  _clientFd = accept(_listenFd, NULL, NULL);
+  if(_clientFd < 0) {
+    return;
+  }
+
+  timeval timeout = { 1, 0 };
+  setsockopt(_clientFd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  std::string request;
+  char buff[512];
+  while(request.find("\r\n\r\n") == std::string::npos && request.size() < 8192) {
+    ssize_t n = recv(_clientFd, buff, sizeof(buff), 0);
+    if(n <= 0) {
+      break;
+    }
+    request.append(buff, n);
+  }
+
+  // "GET /path?query HTTP/1.1"
+  size_t start = request.find(' ');
+  size_t end = start == std::string::npos ? std::string::npos : request.find_first_of(" ?", start + 1);
+  _uri = end == std::string::npos ? "/" : request.substr(start + 1, end - start - 1);
+
+  bool handled = false;
+  for(auto& handler : _handlers) {
+    if(handler.first == _uri) {
+      handler.second();
+      handled = true;
+      break;
+    }
+  }
+  if(!handled) {
+    if(_notFound) {
+      _notFound();
+    }
+    else {
+      send(404, "text/plain", "Not found");
+    }
+  }
+
+  ::close(_clientFd);
+  _clientFd = -1;
+}
+
+void ESP8266WebServer::send(int code, const char* contentType, const char* content) {
+  if(_clientFd < 0) {
+    return;
+  }
+  char header[256];
+  size_t len = strlen(content);
+  int headerLen = snprintf(header, sizeof(header),
+    "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+    code, code == 200 ? "OK" : "Error", contentType, len);
+  ::send(_clientFd, header, headerLen, MSG_NOSIGNAL);
+  ::send(_clientFd, content, len, MSG_NOSIGNAL);
+}
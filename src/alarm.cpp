@@ -1,27 +1,47 @@
 #include <Arduino.h>
 #include <main.h>
-#include <pins.h>
+#include <pattern.h>
 
 #define CLOSE_DOOR_SLOW_BEEP_COUNT    4
 #define CLOSE_DOOR_FAST_BEEP_COUNT    12
 
-// Using an active buzzer.
-// Blocking beep. Mind the for how long before this returns.
-void beepPattern(int beepCount, int beepLengthMs, int restMs) {
+// Using an active buzzer. The red LED blinks along.
+const PatternStep closingDoorPattern[] = {
+  { 2000, 1000, CLOSE_DOOR_SLOW_BEEP_COUNT },
+  { 200, 100, CLOSE_DOOR_FAST_BEEP_COUNT }
+};
 
-  digitalWrite(LED_RED_PIN, 0); //on
+const PatternStep heartbeatPattern[] = {
+  { 100, 1900, 1 }
+};
 
-  for(int n = 0; n < beepCount; n++) {
-    if(n > 0) {
-      delay(restMs);
-    }
-    digitalWrite(BUZZER_PIN, 1);
-    delay(beepLengthMs);
-    digitalWrite(BUZZER_PIN, 0);
-  }
+volatile bool alarmActive = false;
+
+void onClosingDoorAlarmDone(int channel) {
+  alarmActive = false;
 }
 
-void closingDoorAlarm() {
-  beepPattern(CLOSE_DOOR_SLOW_BEEP_COUNT, 2000, 1000);
-  beepPattern(CLOSE_DOOR_FAST_BEEP_COUNT, 200, 100);
+void startClosingDoorAlarm() {
+  alarmActive = true;
+  startPattern(PATTERN_LED_RED, closingDoorPattern, 2);
+  startPattern(PATTERN_BUZZER, closingDoorPattern, 2, false, onClosingDoorAlarmDone);
+}
+
+bool closingDoorAlarmDone() {
+  return !alarmActive;
+}
+
+// Blink red/blue LED based on WiFi state
+int heartbeatChannel = -1;
+void updateStatusLed() {
+  int channel = wifiConnected() ? PATTERN_LED_BLUE : PATTERN_LED_RED;
+  if(alarmActive || (channel == heartbeatChannel && patternRunning(channel))) {
+    return;  // the alarm owns the red LED while on
+  }
+
+  if(heartbeatChannel >= 0) {
+    stopPattern(heartbeatChannel);
+  }
+  startPattern(channel, heartbeatPattern, 1, true);
+  heartbeatChannel = channel;
 }
@@ -0,0 +1,129 @@
+#include <Arduino.h>
+#include <TimeLib.h>
+#include <main.h>
+
+#ifdef LOG_BINARY
+
+#include <ESP8266HTTPClient.h>
+
+#define BINLOG_URL          IOT_API_BASE_URL "/log?deviceid=" DEVICE_ID "&format=bin"
+#define BINLOG_SIZE         1024
+#define BINLOG_HEADER_SIZE  20
+#define BINLOG_VERSION      1
+
+// Batch header, filled in when posting:
+// 'G' 'L' version 0 | epoch secs (0: time not set) | ms now | ms base | records dropped (16 bit)
+// | records length (16 bit), all little endian. The first record's delta counts from ms base.
+uint8_t binLog[BINLOG_HEADER_SIZE + BINLOG_SIZE];
+uint8_t* const binLogRecords = binLog + BINLOG_HEADER_SIZE;
+size_t binLogLen = 0;
+unsigned long binLogBaseMs = 0;       // time the first record's delta counts from
+unsigned long binLogLastMs = 0;       // time of the newest record
+unsigned long binLogDropped = 0;
+unsigned long lastBinLogFlushMs = 0;
+bool binLogFlushFailed = false;
+
+uint32_t readVarint(const uint8_t*& p) {
+  uint32_t v = 0;
+  for(int shift = 0; shift < 35; shift += 7) {
+    v |= (uint32_t)(*p & 0x7f) << shift;
+    if(!(*p++ & 0x80)) {
+      break;
+    }
+  }
+  return v;
+}
+
+void dropOldestBinaryLogRecord() {
+  // the next record's delta now counts from the dropped one
+  const uint8_t* delta = binLogRecords + 5;
+  binLogBaseMs += readVarint(delta);
+  size_t recLen = 1 + binLogRecords[0];
+  memmove(binLogRecords, binLogRecords + recLen, binLogLen - recLen);
+  binLogLen -= recLen;
+  binLogDropped++;
+}
+
+void beginBinaryLog(BinLogRecord& rec, uint32_t formatId) {
+  unsigned long now = millis();
+  if(0 == binLogLen) {
+    binLogBaseMs = now;
+    binLogLastMs = now;
+  }
+  rec.put(0); // length, set when appended
+  rec.put(formatId & 0xff);
+  rec.put((formatId >> 8) & 0xff);
+  rec.put((formatId >> 16) & 0xff);
+  rec.put(formatId >> 24);
+  rec.putVarint(now - binLogLastMs);
+  binLogLastMs = now;
+}
+
+void appendBinaryLog(BinLogRecord& rec) {
+  if(!AppConfig.PostLog) {
+    return;
+  }
+  rec.Data[0] = rec.Len - 1;
+  while(binLogLen + rec.Len > BINLOG_SIZE) {
+    dropOldestBinaryLogRecord();
+  }
+  memcpy(binLogRecords + binLogLen, rec.Data, rec.Len);
+  binLogLen += rec.Len;
+}
+
+void putUint32(uint8_t* p, uint32_t v) {
+  for(int n = 0; n < 4; n++) {
+    p[n] = (v >> (8 * n)) & 0xff;
+  }
+}
+
+void flushBinaryLog() {
+
+  // NOTE: do not call any functions that call log() themselves!
+  unsigned long nowMs = millis();
+  if(0 == binLogLen ||
+    (binLogLen < BINLOG_SIZE * 3 / 4 && nowMs - binLogBaseMs < AppConfig.LogFlushMs)) {
+    return;
+  }
+  if(binLogFlushFailed && nowMs - lastBinLogFlushMs < AppConfig.LogFlushMs) {
+    return; // back off after a failed post
+  }
+
+  binLog[0] = 'G';
+  binLog[1] = 'L';
+  binLog[2] = BINLOG_VERSION;
+  binLog[3] = 0;
+  putUint32(binLog + 4, timeSet == timeStatus() ? now() : 0);
+  putUint32(binLog + 8, nowMs);
+  putUint32(binLog + 12, binLogBaseMs);
+  putUint32(binLog + 16, min(binLogDropped, 0xffffUL) | (binLogLen << 16));
+  size_t size = BINLOG_HEADER_SIZE + binLogLen;
+
+#ifdef IOT_TRANSPORT_MQTT
+  mqttPublish(MQTT_TOPIC_BINLOG, binLog, size);
+#else
+  if(!wifiConnected()) {
+    return;
+  }
+  lastBinLogFlushMs = nowMs;
+
+  HTTPClient& http = iotHttpBegin(BINLOG_URL, 2000);
+  http.addHeader("Content-Type", "application/octet-stream");
+  int code = http.POST(binLog, size);
+  iotHttpEnd(code, size);
+
+  binLogFlushFailed = (code != 200);
+  if(binLogFlushFailed) {
+    Serial.printf("Posting the binary log failed, http code %d\n", code);
+    return;
+  }
+#endif
+  binLogDropped = 0;
+  binLogLen = 0;
+}
+
+#else
+
+void flushBinaryLog() {}
+
+#endif // LOG_BINARY
@@ -3,28 +3,14 @@
 #include <ArduinoJson.h>
 #include <ESP8266HTTPClient.h>
 #include <main.h>
+#include <msgpack.h>
 
 extern HTTPClient httpClient;
-extern WiFiClient wifiClient;
 
 ApplicationConfig AppConfig;
 
 #define CONFIG_URL    IOT_API_BASE_URL "/config?deviceid=" DEVICE_ID
 
-template <typename T>
-void updateValue(const JsonObject &jconfig, const char* key, T &currentValue, int multiplier) {
-  if (jconfig.containsKey(key)) {
-    currentValue = jconfig[key].as<T>() * multiplier;
-  }
-}
-
-template <typename T>
-void updateValue(const JsonObject &jconfig, const char* key, T &currentValue) {
-  if (jconfig.containsKey(key)) {
-    currentValue = jconfig[key].as<T>();
-  }
-}
-
 template <typename T>
 void checkAndSwapValues(T& valMin, T& valMax, const char* nameMin, const char* nameMax) {
   if(valMax < valMin) {
@@ -37,109 +23,577 @@ void checkAndSwapValues(T& valMin, T& valMax, const char* nameMin, const char* n
   }
 }
 
-void parseConfig(const char* json) {
-  StaticJsonBuffer<1024> jsonBuffer;
-  const JsonObject& config = jsonBuffer.parseObject(json);
-  if (!config.success()) {
-    const char* logmsg = log("Failed to parse json:\n%s", json);
+// FNV-1a
+uint32_t hashText(const char* text, size_t len) {
+  uint32_t hash = 2166136261UL;
+  for(size_t n = 0; n < len; n++) {
+    hash = (hash ^ (uint8_t)text[n]) * 16777619UL;
+  }
+  return hash;
+}
+
+// Config schema. Adding a config value takes one row here.
+// Bounds apply to the value as sent in the json, before the multiplier; 0 - 0 means no bounds.
+#define CFG_BOOL    0
+#define CFG_INT     1
+#define CFG_ULONG   2
+#define CFG_RANGE   3 // [from, to] pair of ints
+#define CFG_TEXT    4 // string, MaxValue is the size of the char array
+
+#define CFG_ORDERED 1 // range is swapped if from > to
+
+struct ConfigField {
+  const char* Key;
+  uint32_t KeyHash;
+  uint8_t Type;
+  void* Value;
+  unsigned long Multiplier;
+  long MinValue;
+  long MaxValue;
+  uint8_t Flags;
+  const char* NotBelowKey; // the two values are swapped if this one is less than the other
+};
+
+#define CONFIG_FIELD(key, type, value, mult, minVal, maxVal, flags, notBelow) \
+  { key, hashKey(key), type, value, mult, minVal, maxVal, flags, notBelow }
+
+// The per door rows, keys prefixed for the doors after the first.
+#define DOOR_CONFIG_FIELDS(prefix, door) \
+  CONFIG_FIELD(prefix "KeepClosedSchedule", CFG_TEXT,  AppConfig.Doors[door].KeepClosedSchedule, 1, 0, sizeof(DoorConfig::KeepClosedSchedule), 0, NULL), \
+  CONFIG_FIELD(prefix "PinRangeDoorOpen",   CFG_RANGE, AppConfig.Doors[door].SensorRangeValues[DOOR_OPEN],   1, 0, 1024, CFG_ORDERED, NULL), \
+  CONFIG_FIELD(prefix "PinRangeDoorClosed", CFG_RANGE, AppConfig.Doors[door].SensorRangeValues[DOOR_CLOSED], 1, 0, 1024, CFG_ORDERED, NULL), \
+  CONFIG_FIELD(prefix "PinRangeDoorAjar",   CFG_RANGE, AppConfig.Doors[door].SensorRangeValues[DOOR_AJAR],   1, 0, 1024, CFG_ORDERED, NULL),
+
+const ConfigField configSchema[] = {
+  CONFIG_FIELD("EnableControl",                 CFG_BOOL,  &AppConfig.EnableControl,                1,          0,     0, 0, NULL),
+  CONFIG_FIELD("MainLoopSec",                   CFG_ULONG, &AppConfig.MainLoopMs,                   1000,       1,  3600, 0, NULL),
+  CONFIG_FIELD("MainLoopFastMs",                CFG_ULONG, &AppConfig.MainLoopFastMs,               1,         50,  5000, 0, NULL),
+  CONFIG_FIELD("MainLoopIdleSec",               CFG_ULONG, &AppConfig.MainLoopIdleMs,               1000,       1,  3600, 0, NULL),
+  CONFIG_FIELD("UpdateConfigSec",               CFG_ULONG, &AppConfig.UpdateConfigMs,               1000,      10, 86400, 0, NULL),
+  CONFIG_FIELD("TimeSyncMin",                   CFG_ULONG, &AppConfig.TimeSyncMs,                   60 * 1000,  1,  1440, 0, NULL),
+  CONFIG_FIELD("MaxClosingTries",               CFG_INT,   &AppConfig.MaxClosingTries,              1,          1,    10, 0, NULL),
+  CONFIG_FIELD("DoorClosingTimeSec",            CFG_ULONG, &AppConfig.DoorClosingTimeMs,            1000,       1,   300, 0, NULL),
+  CONFIG_FIELD("TimeBetweenClosingAttemptsMin", CFG_ULONG, &AppConfig.TimeBetweenClosingAttemptsMs, 60 * 1000,  1,  1440, 0, NULL),
+  CONFIG_FIELD("DoorClosingSwitchPressMs",      CFG_ULONG, &AppConfig.DoorClosingSwitchPressMs,     1,         50,  5000, 0, NULL),
+  CONFIG_FIELD("MaxDoorOpenMin",                CFG_ULONG, &AppConfig.MaxDoorOpenMs,                60 * 1000,  0, 10080, 0, "MinDoorOpenMin"),
+  CONFIG_FIELD("MinDoorOpenMin",                CFG_ULONG, &AppConfig.MinDoorOpenMs,                60 * 1000,  0,  1440, 0, NULL),
+  CONFIG_FIELD("MinNotifyPeriodSec",            CFG_ULONG, &AppConfig.MinNotifyPeriodMs,            1000,       0, 86400, 0, NULL),
+  CONFIG_FIELD("DebounceReadCount",             CFG_INT,   &AppConfig.DebounceReadCount,            1,          1,    20, 0, NULL),
+  CONFIG_FIELD("DebounceReadPauseMs",           CFG_INT,   &AppConfig.DebounceReadPauseMs,          1,         10,  5000, 0, NULL),
+  CONFIG_FIELD("DebugLog",                      CFG_BOOL,  &AppConfig.DebugLog,                     1,          0,     0, 0, NULL),
+  CONFIG_FIELD("PostLog",                       CFG_BOOL,  &AppConfig.PostLog,                      1,          0,     0, 0, NULL),
+  CONFIG_FIELD("LogFlushSec",                   CFG_ULONG, &AppConfig.LogFlushMs,                   1000,       1,  3600, 0, NULL),
+  CONFIG_FIELD("LogFlushLines",                 CFG_INT,   &AppConfig.LogFlushLines,                1,          1,   100, 0, NULL),
+  CONFIG_FIELD("KeepClosedFromTo",              CFG_RANGE, AppConfig.KeepClosedFromTo,              1,          0,  2359, 0, NULL),
+  CONFIG_FIELD("KeepClosedHolidays",            CFG_TEXT,  AppConfig.KeepClosedHolidays,            1,          0, sizeof(AppConfig.KeepClosedHolidays), 0, NULL),
+  DOOR_CONFIG_FIELDS("", 0)
+#if DOOR_COUNT > 1
+  DOOR_CONFIG_FIELDS("Door1", 1)
+#endif
+  CONFIG_FIELD("MetricsReportMin",              CFG_ULONG, &AppConfig.MetricsReportMs,              60 * 1000,  0, 10080, 0, NULL),
+  CONFIG_FIELD("AutoCalibrateSensor",           CFG_BOOL,  &AppConfig.AutoCalibrateSensor,          1,          0,     0, 0, NULL),
+  CONFIG_FIELD("LogRawSensor",                  CFG_BOOL,  &AppConfig.LogRawSensor,                 1,          0,     0, 0, NULL),
+};
+#define CONFIG_FIELD_COUNT ((int)(sizeof(configSchema) / sizeof(configSchema[0])))
+
+// Open addressing index of the schema by key hash, built on first use.
+#define CONFIG_INDEX_SIZE 64 // power of 2, well above the field count
+int8_t configIndex[CONFIG_INDEX_SIZE];
+bool configIndexBuilt = false;
+
+void buildConfigIndex() {
+  memset(configIndex, -1, sizeof(configIndex));
+  for(int f = 0; f < CONFIG_FIELD_COUNT; f++) {
+    uint32_t slot = configSchema[f].KeyHash;
+    while(configIndex[slot & (CONFIG_INDEX_SIZE - 1)] >= 0) {
+      slot++;
+    }
+    configIndex[slot & (CONFIG_INDEX_SIZE - 1)] = f;
+  }
+  configIndexBuilt = true;
+}
+
+int findConfigField(const char* key) {
+  if(!configIndexBuilt) {
+    buildConfigIndex();
+  }
+  uint32_t hash = hashText(key, strlen(key));
+  for(uint32_t slot = hash; ; slot++) {
+    int f = configIndex[slot & (CONFIG_INDEX_SIZE - 1)];
+    if(f < 0) {
+      return -1;
+    }
+    if(configSchema[f].KeyHash == hash && 0 == strcmp(configSchema[f].Key, key)) {
+      return f;
+    }
+  }
+}
+
+long boundConfigValue(const ConfigField& field, long value) {
+  if(field.MinValue == 0 && field.MaxValue == 0) {
+    return value;
+  }
+  if(value < field.MinValue || value > field.MaxValue) {
+    long bounded = value < field.MinValue ? field.MinValue : field.MaxValue;
+    const char* logmsg = log("%s value %ld is out of range [%ld - %ld]. Using %ld.", field.Key, value, field.MinValue, field.MaxValue, bounded);
     sendNotification(IOT_EVENT_CONFIG_ERROR, logmsg, -1);
-    return;
+    return bounded;
   }
+  return value;
+}
 
-  updateValue(config, "EnableControl", AppConfig.EnableControl);
-  updateValue(config, "MainLoopSec", AppConfig.MainLoopMs, 1000);
-  updateValue(config, "UpdateConfigSec", AppConfig.UpdateConfigMs, 1000);
-  updateValue(config, "MaxClosingTries", AppConfig.MaxClosingTries);
-  updateValue(config, "DoorClosingTimeSec", AppConfig.DoorClosingTimeMs, 1000);
-  updateValue(config, "TimeBetweenClosingAttemptsMin", AppConfig.TimeBetweenClosingAttemptsMs, 60 * 1000);
-  updateValue(config, "DoorClosingSwitchPressMs", AppConfig.DoorClosingSwitchPressMs);
-  updateValue(config, "MaxDoorOpenMin", AppConfig.MaxDoorOpenMs, 60 * 1000);
-  updateValue(config, "MinDoorOpenMin", AppConfig.MinDoorOpenMs, 60 * 1000);
-  updateValue(config, "MinNotifyPeriodSec", AppConfig.MinNotifyPeriodMs, 1000);
-  updateValue(config, "DebounceReadCount", AppConfig.DebounceReadCount);
-  updateValue(config, "DebounceReadPauseMs", AppConfig.DebounceReadPauseMs);
-  updateValue(config, "DebugLog", AppConfig.DebugLog);
-  updateValue(config, "PostLog", AppConfig.PostLog);
+// values[1] is only used by ranges
+void storeConfigValue(const ConfigField& field, const long* values) {
+  switch(field.Type) {
+    case CFG_BOOL:
+      *(bool*)field.Value = values[0] != 0;
+      break;
+    case CFG_INT:
+      *(int*)field.Value = boundConfigValue(field, values[0]) * field.Multiplier;
+      break;
+    case CFG_ULONG:
+      *(unsigned long*)field.Value = boundConfigValue(field, values[0]) * field.Multiplier;
+      break;
+    case CFG_RANGE: {
+      int* range = (int*)field.Value;
+      range[0] = boundConfigValue(field, values[0]) * field.Multiplier;
+      range[1] = boundConfigValue(field, values[1]) * field.Multiplier;
+      break;
+    }
+  }
+}
 
-  checkAndSwapValues(AppConfig.MinDoorOpenMs, AppConfig.MaxDoorOpenMs, "MinDoorOpenMs", "MaxDoorOpenMs");
+void storeConfigText(const ConfigField& field, const char* text, size_t len) {
+  if(len >= (size_t)field.MaxValue) {
+    const char* logmsg = log("%s is too long (%d chars), max %ld chars.", field.Key, len, field.MaxValue - 1);
+    sendNotification(IOT_EVENT_CONFIG_ERROR, logmsg, -1);
+    len = field.MaxValue - 1;
+  }
+  memcpy(field.Value, text, len);
+  ((char*)field.Value)[len] = '\0';
+}
 
-  if (config.containsKey("KeepClosedFromTo")) {
-    JsonArray &ja = config["KeepClosedFromTo"].as<JsonArray>();
-    AppConfig.KeepClosedFromTo[0] = ja[0].as<int>();
-    AppConfig.KeepClosedFromTo[1] = ja[1].as<int>();
+void applyConfigValue(const ConfigField& field, const JsonVariant& value) {
+  long values[2] = { 0, 0 };
+  if(field.Type == CFG_TEXT) {
+    const char* text = value.as<const char*>();
+    storeConfigText(field, text != NULL ? text : "", text != NULL ? strlen(text) : 0);
+    return;
   }
+  if(field.Type == CFG_BOOL) {
+    values[0] = value.as<bool>();
+  }
+  else if(field.Type == CFG_RANGE) {
+    JsonArray &ja = value.as<JsonArray>();
+    values[0] = ja[0].as<long>();
+    values[1] = ja[1].as<long>();
+  }
+  else {
+    values[0] = value.as<long>();
+  }
+  storeConfigValue(field, values);
+}
 
-  if (config.containsKey("PinRangeDoorOpen")) {
-    JsonArray &ja = config["PinRangeDoorOpen"].as<JsonArray>();
-    AppConfig.SensorRangeValues[DOOR_OPEN][0] = ja[0].as<int>();
-    AppConfig.SensorRangeValues[DOOR_OPEN][1] = ja[1].as<int>();
+bool applyConfigValue(const ConfigField& field, MsgPackReader& reader) {
+  long values[2] = { 0, 0 };
+  if(field.Type == CFG_TEXT) {
+    const char* text;
+    size_t len;
+    if(!reader.readStr(text, len)) {
+      return false;
+    }
+    storeConfigText(field, text, len);
+    return true;
+  }
+  if(field.Type == CFG_BOOL) {
+    bool b;
+    if(!reader.readBool(b)) {
+      return false;
+    }
+    values[0] = b;
   }
-  checkAndSwapValues(AppConfig.SensorRangeValues[DOOR_OPEN][0], AppConfig.SensorRangeValues[DOOR_OPEN][1], "PinRangeDoorOpen-from", "PinRangeDoorOpen-to");
+  else if(field.Type == CFG_RANGE) {
+    size_t count;
+    if(!reader.readArray(count) || count != 2 || !reader.readInt(values[0]) || !reader.readInt(values[1])) {
+      return false;
+    }
+  }
+  else if(!reader.readInt(values[0])) {
+    return false;
+  }
+  storeConfigValue(field, values);
+  return true;
+}
 
-  if (config.containsKey("PinRangeDoorClosed")) {
-    JsonArray &ja = config["PinRangeDoorClosed"].as<JsonArray>();
-    AppConfig.SensorRangeValues[DOOR_CLOSED][0] = ja[0].as<int>();
-    AppConfig.SensorRangeValues[DOOR_CLOSED][1] = ja[1].as<int>();
+void checkConfigField(const ConfigField& field, const bool* updated) {
+  int f = &field - configSchema;
+  if(field.Type == CFG_RANGE && (field.Flags & CFG_ORDERED) && updated[f]) {
+    int* range = (int*)field.Value;
+    char nameFrom[40], nameTo[40];
+    snprintf(nameFrom, sizeof(nameFrom), "%s-from", field.Key);
+    snprintf(nameTo, sizeof(nameTo), "%s-to", field.Key);
+    checkAndSwapValues(range[0], range[1], nameFrom, nameTo);
   }
-  checkAndSwapValues(AppConfig.SensorRangeValues[DOOR_CLOSED][0], AppConfig.SensorRangeValues[DOOR_CLOSED][1], "PinRangeDoorClosed-from", "PinRangeDoorClosed-to");
+  else if(field.NotBelowKey != NULL) {
+    int minf = findConfigField(field.NotBelowKey);
+    if(updated[f] || updated[minf]) {
+      const ConfigField& minField = configSchema[minf];
+      checkAndSwapValues(*(unsigned long*)minField.Value, *(unsigned long*)field.Value, minField.Key, field.Key);
+    }
+  }
+}
 
-  if (config.containsKey("PinRangeDoorAjar")) {
-    JsonArray &ja = config["PinRangeDoorAjar"].as<JsonArray>();
-    AppConfig.SensorRangeValues[DOOR_AJAR][0] = ja[0].as<int>();
-    AppConfig.SensorRangeValues[DOOR_AJAR][1] = ja[1].as<int>();
+// The effective config as json, in the units of the config keys.
+size_t formatConfig(char* buff, size_t size) {
+  StaticJsonBuffer<JSON_OBJECT_SIZE(CONFIG_FIELD_COUNT) + CONFIG_FIELD_COUNT * JSON_ARRAY_SIZE(2)> jsonBuffer;
+  JsonObject& config = jsonBuffer.createObject();
+  for(int f = 0; f < CONFIG_FIELD_COUNT; f++) {
+    const ConfigField& field = configSchema[f];
+    switch(field.Type) {
+      case CFG_BOOL:
+        config[field.Key] = *(bool*)field.Value;
+        break;
+      case CFG_INT:
+        config[field.Key] = (long)(*(int*)field.Value / (long)field.Multiplier);
+        break;
+      case CFG_ULONG:
+        config[field.Key] = *(unsigned long*)field.Value / field.Multiplier;
+        break;
+      case CFG_RANGE: {
+        JsonArray& range = config.createNestedArray(field.Key);
+        range.add(((int*)field.Value)[0] / (long)field.Multiplier);
+        range.add(((int*)field.Value)[1] / (long)field.Multiplier);
+        break;
+      }
+      case CFG_TEXT:
+        config[field.Key] = (const char*)field.Value;
+        break;
+    }
   }
-  checkAndSwapValues(AppConfig.SensorRangeValues[DOOR_AJAR][0], AppConfig.SensorRangeValues[DOOR_AJAR][1], "PinRangeDoorAjar-from", "PinRangeDoorAjar-to");
+  return config.printTo(buff, size);
+}
+
+// Config is read into a fixed buffer and parsed in place:
+// ArduinoJson keeps pointers into the text instead of copying the strings.
+#define CONFIG_JSON_SIZE    1024
+char configBody[CONFIG_BODY_SIZE];
+StaticJsonBuffer<CONFIG_JSON_SIZE> configJsonBuffer;
+
+// Collects a response body into a fixed buffer, without any String in between.
+// The free heap is sampled on every write, so the low point of the read is known.
+class BufferStream : public Stream {
+public:
+  BufferStream(char* buff, size_t size) : _buff(buff), _size(size), _minFreeHeap(ESP.getFreeHeap()) { _buff[0] = '\0'; }
+
+  size_t write(uint8_t c) { return write(&c, 1); }
+  size_t write(const uint8_t* data, size_t len) {
+    _minFreeHeap = min(_minFreeHeap, ESP.getFreeHeap());
+    if(_len + len > _size - 1) {
+      _overflow = true;
+      return 0;
+    }
+    memcpy(_buff + _len, data, len);
+    _len += len;
+    _buff[_len] = '\0';
+    return len;
+  }
+  int availableForWrite() { return _size - 1 - _len; }
+  int available() { return 0; }
+  int read() { return -1; }
+  int peek() { return -1; }
+  void flush() {}
+
+  size_t length() const { return _len; }
+  bool overflow() const { return _overflow; }
+  uint32_t minFreeHeap() const { return _minFreeHeap; }
 
+private:
+  char* _buff;
+  size_t _size;
+  uint32_t _minFreeHeap;
+  size_t _len = 0;
+  bool _overflow = false;
+};
+
+void finishConfig(const bool* updated);
+
+bool parseConfig(char* json) {
   logd("Configuration pulled from %s", CONFIG_URL);
-  logd(json);
+  logd("%s", json);
+
+  configJsonBuffer.clear();
+  const JsonObject& config = configJsonBuffer.parseObject(json);
+  if (!config.success()) {
+    // the text has been modified by the parser, can't show it
+    const char* logmsg = log("Failed to parse json config (%d bytes).", strlen(json));
+    sendNotification(IOT_EVENT_CONFIG_ERROR, logmsg, -1);
+    return false;
+  }
+
+  // walk the json once, looking up each key in the schema
+  bool updated[CONFIG_FIELD_COUNT] = { false };
+  for(const JsonPair& kv : config) {
+    int f = findConfigField(kv.key);
+    if(f < 0) {
+      logd("Unknown config key: %s", kv.key);
+      continue;
+    }
+    applyConfigValue(configSchema[f], kv.value);
+    updated[f] = true;
+  }
+
+  finishConfig(updated);
+  return true;
+}
+
+// Checks across fields and the evaluated values, after a config has been applied.
+void finishConfig(const bool* updated) {
+  applySensorCalibration();
+  for(int f = 0; f < CONFIG_FIELD_COUNT; f++) {
+    checkConfigField(configSchema[f], updated);
+  }
 
   logd("Pin range values.");
-  for(int ds = DOOR_OPEN; ds < DOOR_STATE_COUNT; ds++) {
-    logd("Door state %d: %d - %d", ds, AppConfig.SensorRangeValues[ds][0], AppConfig.SensorRangeValues[ds][1]);
+  for(int door = 0; door < DOOR_COUNT; door++) {
+    const int (*ranges)[2] = AppConfig.Doors[door].SensorRangeValues;
+    for(int ds = DOOR_OPEN; ds < DOOR_STATE_COUNT; ds++) {
+      logd("Door %d state %d: %d - %d", door, ds, ranges[ds][0], ranges[ds][1]);
+    }
   }
 
   formatMillis(AppConfig.txtMinOpenTime, AppConfig.MinDoorOpenMs);
   formatMillis(AppConfig.txtMaxOpenTime, AppConfig.MaxDoorOpenMs);
+  compileSchedule();
 }
 
-const char* respHeaders[] = { "X-IoT-LocalTime" };
+// Same config as a MessagePack map, keys as in the json.
+bool parseConfigMsgPack(const uint8_t* data, size_t len) {
+  logd("Configuration pulled from %s, %d bytes of msgpack.", CONFIG_URL, len);
 
-void SetTime() {
+  MsgPackReader reader(data, len);
+  size_t count;
+  if(!reader.readMap(count)) {
+    const char* logmsg = log("Failed to parse msgpack config (%d bytes).", len);
+    sendNotification(IOT_EVENT_CONFIG_ERROR, logmsg, -1);
+    return false;
+  }
+
+  bool updated[CONFIG_FIELD_COUNT] = { false };
+  bool ok = true;
+  while(ok && count-- > 0) {
+    const char* keyText;
+    size_t keyLen;
+    char key[40];
+    if(!reader.readStr(keyText, keyLen)) {
+      ok = false;
+      break;
+    }
+    keyLen = min(keyLen, sizeof(key) - 1);
+    memcpy(key, keyText, keyLen);
+    key[keyLen] = '\0';
+
+    int f = findConfigField(key);
+    if(f < 0) {
+      logd("Unknown config key: %s", key);
+      if(!reader.skip()) {
+        ok = false;
+        break;
+      }
+      continue;
+    }
+    if(!applyConfigValue(configSchema[f], reader)) {
+      const char* logmsg = log("Bad msgpack value for config key %s.", key);
+      sendNotification(IOT_EVENT_CONFIG_ERROR, logmsg, -1);
+      ok = false;
+      break;
+    }
+    updated[f] = true;
+  }
+  if(!ok && reader.error()) {
+    const char* logmsg = log("Failed to parse msgpack config (%d bytes).", len);
+    sendNotification(IOT_EVENT_CONFIG_ERROR, logmsg, -1);
+  }
+
+  // the values applied before an error are kept
+  finishConfig(updated);
+  return ok;
+}
+
+// Json configs start with '{' (maybe after whitespace), msgpack ones with a map marker.
+bool isMsgPackConfig(const char* body, size_t len) {
+  uint8_t b = len > 0 ? body[0] : 0;
+  return (b & 0xf0) == 0x80 || b == 0xde || b == 0xdf;
+}
+
+bool parseConfigBody(char* body, size_t len) {
+  if(isMsgPackConfig(body, len)) {
+    return parseConfigMsgPack((const uint8_t*)body, len);
+  }
+  return parseConfig(body);
+}
+
+// The config is only parsed when it has changed.
+// The server can answer 304 to the ETag of the last applied config;
+// failing that, a body with the same hash as the last one parsed is skipped,
+// a rejected one too: its error is reported once, not on every pull.
+#define CONFIG_ETAG_LEN 64
+char lastConfigETag[CONFIG_ETAG_LEN] = "";
+uint32_t lastConfigHash = 0;
+
+const char* respHeaders[] = { "X-IoT-LocalTime", "ETag", "Content-Type" };
+
+// Payload encoding for the server, negotiated on the config pull:
+// the device accepts msgpack, and posts msgpack once the server has answered with it.
+int IotWireFormat = WIRE_JSON;
+
+// The effective config is kept in flash, to start with it before the server answers.
+// It is only written when it differs from the stored one.
+#define CONFIG_CACHE_FILE   "/config.json"
+#define CONFIG_CACHE_TMP    "/config.tmp"
+uint32_t cachedConfigHash = 0;
+
+void saveConfigCache() {
+  size_t len = formatConfig(configBody, CONFIG_BODY_SIZE);
+  uint32_t hash = hashText(configBody, len);
+  if(hash == cachedConfigHash) {
+    return;
+  }
+  if(writePersistedFile(CONFIG_CACHE_FILE, CONFIG_CACHE_TMP, configBody, len)) {
+    cachedConfigHash = hash;
+    logd("Config saved to flash, %d bytes.", len);
+  }
+}
+
+void restoreConfig() {
+  size_t len = readPersistedFile(CONFIG_CACHE_FILE, configBody, CONFIG_BODY_SIZE - 1);
+  if(0 == len) {
+    log("No saved config, using the defaults.");
+    return;
+  }
+  configBody[len] = '\0';
+  cachedConfigHash = hashText(configBody, len);
+  if(parseConfigBody(configBody, len)) {
+    log("Saved config restored.");
+  }
+}
+
+// The server's local time, a fallback for SNTP and the source of the time zone offset.
+void SetTime(unsigned long latencyMs) {
   String timeTxt = httpClient.header(respHeaders[0]);
+  tmElements_t tm;
   int year, month, date, hour, minute, second;
-  sscanf(timeTxt.c_str(), "%4d%02d%02d%02d%02d%02d", &year, &month, &date, &hour, &minute, &second);
-  setTime(hour, minute, second, date, month, year);
-  if(timeSet != timeStatus()) {
+  if(6 != sscanf(timeTxt.c_str(), "%4d%02d%02d%02d%02d%02d", &year, &month, &date, &hour, &minute, &second)) {
     const char* logmsg = log("Failed to set time from header.");
     sendNotification(IOT_EVENT_CONFIG_ERROR, logmsg, -1);
+    return;
+  }
+  tm.Year = CalendarYrToTm(year);
+  tm.Month = month;
+  tm.Day = date;
+  tm.Hour = hour;
+  tm.Minute = minute;
+  tm.Second = second;
+  syncTimeFromHeader(makeTime(tm), latencyMs);
+}
+
+// Config pushed by the server (MQTT), applied the same way as a pulled one.
+void applyPushedConfig(const char* text, size_t len) {
+  if(len >= CONFIG_BODY_SIZE) {
+    const char* logmsg = log("Config is too large (%d bytes), max %d bytes.", len, CONFIG_BODY_SIZE - 1);
+    sendNotification(IOT_EVENT_CONFIG_ERROR, logmsg, -1);
+    return;
+  }
+  memcpy(configBody, text, len);
+  configBody[len] = '\0';
+
+  uint32_t hash = hashText(configBody, len);
+  if(hash == lastConfigHash) {
+    logd("Configuration unchanged.");
+    return;
+  }
+  lastConfigHash = hash;
+  lastConfigETag[0] = '\0';
+  if(parseConfigBody(configBody, len)) {
+    saveConfigCache();
   }
 }
 
 unsigned long lastConfigUpdate = 0;
+bool configPullMissed = false; // no wifi at the last pull, try again on the next pass
 void updateConfig(bool force) {
+#ifdef IOT_TRANSPORT_MQTT
+  // the config is pushed on its topic and SNTP keeps the clock,
+  // pulled only at the start and while the broker can't be reached
+  if(!force && mqttConnected()) {
+    return;
+  }
+#endif
   unsigned long now = millis();
-  if(!force && (now - lastConfigUpdate < AppConfig.UpdateConfigMs)) {
+  if(!force && !configPullMissed && (now - lastConfigUpdate < AppConfig.UpdateConfigMs)) {
     return;
   }
   lastConfigUpdate = now;
+  configPullMissed = !ensureWiFi();
+
+  if(!configPullMissed) {
+    HTTPClient& http = iotHttpBegin(CONFIG_URL, 10000);
+    http.collectHeaders(respHeaders, 3);
+    http.addHeader("Accept", MSGPACK_CONTENT_TYPE ", application/json;q=0.5");
+    if(!force && lastConfigETag[0] != '\0') {
+      http.addHeader("If-None-Match", lastConfigETag);
+    }
+    uint32_t heapBefore = ESP.getFreeHeap();
+    unsigned long requestMs = millis();
+    int code = http.GET();
+    unsigned long latencyMs = millis() - requestMs;
+    if(code == 304) {
+      SetTime(latencyMs);
+      logd("Configuration not modified.");
+    }
+    else if(code == 200) {
+      SetTime(latencyMs);
+      IotWireFormat = http.header(respHeaders[2]).startsWith(MSGPACK_CONTENT_TYPE) ? WIRE_MSGPACK : WIRE_JSON;
+      BufferStream body(configBody, CONFIG_BODY_SIZE);
+      int size = http.getSize();
+      if(size < CONFIG_BODY_SIZE) {
+        http.writeToStream(&body);
+      }
+      // peak use while the response was read, the heap may have grown back since
+      uint32_t heapPeak = heapBefore > body.minFreeHeap() ? heapBefore - body.minFreeHeap() : 0;
 
-  if(ensureWiFi()) {
-    httpClient.setTimeout(10000);
-    httpClient.begin(wifiClient, CONFIG_URL);
-    httpClient.collectHeaders(respHeaders, 1);
-    int code = httpClient.GET();
-    if(code == 200) {
-      SetTime();
-      String body = httpClient.getString();
-      parseConfig(body.c_str());
+      if(size >= CONFIG_BODY_SIZE || body.overflow()) {
+        const char* logmsg = log("Config is too large (%d bytes), max %d bytes.", size, CONFIG_BODY_SIZE - 1);
+        sendNotification(IOT_EVENT_CONFIG_ERROR, logmsg, -1);
+        code = HTTPC_ERROR_TOO_LESS_RAM; // the body is not read, don't reuse the connection
+      }
+      else {
+        uint32_t hash = hashText(configBody, body.length());
+        if(!force && hash == lastConfigHash) {
+          logd("Configuration unchanged.");
+        }
+        else {
+          lastConfigHash = hash;
+          lastConfigETag[0] = '\0';
+          if(parseConfigBody(configBody, body.length())) {
+            strncpy(lastConfigETag, http.header(respHeaders[1]).c_str(), CONFIG_ETAG_LEN - 1);
+            logd("Config pull memory: body %d of %d bytes, json %d of %d bytes, heap peak %lu bytes, low %lu bytes.",
+              body.length(), CONFIG_BODY_SIZE, configJsonBuffer.size(), CONFIG_JSON_SIZE,
+              (unsigned long) heapPeak, (unsigned long) body.minFreeHeap());
+            saveConfigCache();
+          }
+        }
+      }
     }
     else {
       log("Cannot pull config. Http code %d", code);
     }
-    httpClient.end();
+    iotHttpEnd(code);
+    logd("Http requests: %lu, reused connection: %lu, failed: %lu. Latency last: %lu ms, max: %lu ms, avg: %lu ms."
+      , IotHttpStats.Requests, IotHttpStats.Reused, IotHttpStats.Failures
+      , IotHttpStats.LastLatencyMs, IotHttpStats.MaxLatencyMs, IotHttpStats.TotalLatencyMs / IotHttpStats.Requests);
   }
   else {
-   log("Cannot pull config: no wifi.");
+    logd("Cannot pull config: no wifi.");
   }
 
 }
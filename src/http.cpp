@@ -0,0 +1,48 @@
+#include <Arduino.h>
+#include <ESP8266HTTPClient.h>
+#include <main.h>
+
+// One HTTP/1.1 keep-alive connection to the iot-helper API, shared by all requests.
+// It is opened on the first request and reopened lazily after a failure.
+HTTPClient httpClient;
+WiFiClient wifiClient;
+
+HttpStats IotHttpStats;
+unsigned long httpRequestStartMs = 0;
+
+HTTPClient& iotHttpBegin(const char* url, uint16_t timeoutMs) {
+  bool reused = wifiClient.connected();
+
+  httpClient.setReuse(true);
+  httpClient.begin(wifiClient, url);
+  httpClient.setTimeout(timeoutMs);
+
+  IotHttpStats.Requests++;
+  if(reused) {
+    IotHttpStats.Reused++;
+  }
+  httpRequestStartMs = millis();
+  return httpClient;
+}
+
+void iotHttpEnd(int code, size_t bytesSent) {
+  unsigned long latencyMs = millis() - httpRequestStartMs;
+  IotHttpStats.BytesSent += bytesSent;
+  IotHttpStats.LastLatencyMs = latencyMs;
+  IotHttpStats.TotalLatencyMs += latencyMs;
+  if(latencyMs > IotHttpStats.MaxLatencyMs) {
+    IotHttpStats.MaxLatencyMs = latencyMs;
+  }
+
+  // keeps the connection open, unless the server asked to close it
+  httpClient.end();
+
+  if(code < 0) {
+    // connection level failure, start with a fresh connection next time
+    IotHttpStats.Failures++;
+    wifiClient.stop();
+  }
+  else if(code != 200 && code != 304) {
+    IotHttpStats.Failures++;
+  }
+}
@@ -0,0 +1,232 @@
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <ESP8266HTTPClient.h>
+#include <main.h>
+
+// Door history: transitions, close attempts and their results, as fixed size records in a ring
+// file on LittleFS. journalEvent() only fills a record in RAM. serviceJournal() writes the records
+// out from loop() and uploads the unsent ones in batches, every JOURNAL_UPLOAD_MS, back to back
+// while a backlog is left or the ring is getting full. Each acknowledged batch moves the acked
+// sequence number on, and frees those slots for new records. When the ring fills up with unsent
+// records, the oldest are overwritten.
+
+#define JOURNAL_URL             IOT_API_BASE_URL "/journal?deviceid=" DEVICE_ID
+#define JOURNAL_FILE            "/journal.bin"
+#define JOURNAL_ACK_FILE        "/journal.ack"
+#define JOURNAL_ACK_TMP         "/journal.tmp"
+#define JOURNAL_CAPACITY        256     // records in the ring file, 4 KB
+#define JOURNAL_PENDING         8       // records waiting in RAM for the file
+#define JOURNAL_BATCH           32      // records per upload
+#define JOURNAL_RETRY_MS        (60UL * 1000)
+#define JOURNAL_UPLOAD_MS       (15UL * 60 * 1000)
+#define JOURNAL_NEAR_FULL       (JOURNAL_CAPACITY * 3 / 4) // unsent records uploaded without waiting
+#define JOURNAL_HEADER_SIZE     16
+#define JOURNAL_VERSION         1
+
+// Record, little endian. Slot n of the file holds the record with Seq % JOURNAL_CAPACITY == n,
+// Seq 0 is an empty slot.
+struct JournalRecord {
+  uint32_t Seq;
+  uint32_t Utc;       // seconds, 0 when the time was not known
+  uint32_t Ms;        // millis() at the event
+  uint8_t Type;       // JOURNAL_* | door << 4
+  uint8_t Value;
+  uint16_t Detail;
+};
+
+JournalStats IotJournalStats;
+
+bool journalReady = false;
+uint32_t journalNextSeq = 1;
+uint32_t journalWrittenSeq = 0;   // newest record in the file
+uint32_t journalAckedSeq = 0;     // newest record the server has
+JournalRecord journalPending[JOURNAL_PENDING];
+int journalPendingCount = 0;
+unsigned long lastJournalUploadMs = 0;
+bool journalUploadFailed = false;
+bool journalBacklog = false;      // the last upload left unsent records
+
+// Batch header: 'G' 'J' version record size | epoch secs (0: time not set) | ms now | records dropped.
+uint8_t journalBatch[JOURNAL_HEADER_SIZE + JOURNAL_BATCH * sizeof(JournalRecord)];
+
+void journalEvent(int type, int value, int detail, int door) {
+  if(!journalReady) {
+    return;
+  }
+  if(JOURNAL_PENDING == journalPendingCount) {
+    memmove(journalPending, journalPending + 1, sizeof(JournalRecord) * (JOURNAL_PENDING - 1));
+    journalPendingCount--;
+    IotJournalStats.Dropped++;
+  }
+  JournalRecord& rec = journalPending[journalPendingCount++];
+  rec.Seq = journalNextSeq++;
+  rec.Utc = TIME_CONFIDENCE_NONE == timeConfidence() ? 0 : utcNowMs() / 1000;
+  rec.Ms = millis();
+  rec.Type = type | (door << 4);
+  rec.Value = value;
+  rec.Detail = detail;
+  IotJournalStats.Records++;
+}
+
+void startJournal() {
+  File file = LittleFS.open(JOURNAL_FILE, "r");
+  if(file && file.size() == JOURNAL_CAPACITY * sizeof(JournalRecord)) {
+    JournalRecord rec;
+    while(file.read((uint8_t*) &rec, sizeof(rec)) == sizeof(rec)) {
+      journalWrittenSeq = max(journalWrittenSeq, rec.Seq);
+    }
+    file.close();
+  }
+  else {
+    if(file) {
+      file.close();
+    }
+    file = LittleFS.open(JOURNAL_FILE, "w");
+    if(!file) {
+      log("No door journal, cannot create %s.", JOURNAL_FILE);
+      return;
+    }
+    JournalRecord empty = {};
+    for(int n = 0; n < JOURNAL_CAPACITY; n++) {
+      file.write((const uint8_t*) &empty, sizeof(empty));
+    }
+    file.close();
+  }
+
+  uint32_t ackedSeq = 0;
+  if(sizeof(ackedSeq) == readPersistedFile(JOURNAL_ACK_FILE, (char*) &ackedSeq, sizeof(ackedSeq))) {
+    journalAckedSeq = min(ackedSeq, journalWrittenSeq);
+  }
+  journalAckedSeq = max(journalAckedSeq, journalWrittenSeq > JOURNAL_CAPACITY ? journalWrittenSeq - JOURNAL_CAPACITY : 0);
+  journalNextSeq = journalWrittenSeq + 1;
+  journalReady = true;
+  logd("Door journal: %lu records, %lu unsent.", (unsigned long) journalWrittenSeq, (unsigned long) (journalWrittenSeq - journalAckedSeq));
+}
+
+void writeJournalPending() {
+  File file = LittleFS.open(JOURNAL_FILE, "r+");
+  if(!file) {
+    return; // kept in RAM, tried again on the next pass
+  }
+  for(int n = 0; n < journalPendingCount; n++) {
+    const JournalRecord& rec = journalPending[n];
+    file.seek((rec.Seq % JOURNAL_CAPACITY) * sizeof(JournalRecord), SeekSet);
+    file.write((const uint8_t*) &rec, sizeof(rec));
+    journalWrittenSeq = rec.Seq;
+  }
+  file.close();
+  journalPendingCount = 0;
+
+  if(journalWrittenSeq - journalAckedSeq > JOURNAL_CAPACITY) {
+    // unsent records were overwritten
+    IotJournalStats.Dropped += journalWrittenSeq - journalAckedSeq - JOURNAL_CAPACITY;
+    journalAckedSeq = journalWrittenSeq - JOURNAL_CAPACITY;
+  }
+}
+
+size_t readJournalBatch() {
+  File file = LittleFS.open(JOURNAL_FILE, "r");
+  if(!file) {
+    return 0;
+  }
+  size_t count = 0;
+  uint8_t* records = journalBatch + JOURNAL_HEADER_SIZE;
+  for(uint32_t seq = journalAckedSeq + 1; seq <= journalWrittenSeq && count < JOURNAL_BATCH; seq++) {
+    JournalRecord rec;
+    file.seek((seq % JOURNAL_CAPACITY) * sizeof(rec), SeekSet);
+    if(file.read((uint8_t*) &rec, sizeof(rec)) != sizeof(rec) || rec.Seq != seq) {
+      IotJournalStats.Dropped++; // a slot that didn't make it to flash
+      continue;
+    }
+    memcpy(records + count++ * sizeof(rec), &rec, sizeof(rec));
+  }
+  file.close();
+  return count;
+}
+
+void putJournalUint32(uint8_t* p, uint32_t v) {
+  for(int n = 0; n < 4; n++) {
+    p[n] = (v >> (8 * n)) & 0xff;
+  }
+}
+
+void uploadJournal() {
+  uint32_t lastSeq = min(journalWrittenSeq, journalAckedSeq + JOURNAL_BATCH);
+  size_t count = readJournalBatch();
+
+  journalBatch[0] = 'G';
+  journalBatch[1] = 'J';
+  journalBatch[2] = JOURNAL_VERSION;
+  journalBatch[3] = sizeof(JournalRecord);
+  putJournalUint32(journalBatch + 4, TIME_CONFIDENCE_NONE == timeConfidence() ? 0 : utcNowMs() / 1000);
+  putJournalUint32(journalBatch + 8, millis());
+  putJournalUint32(journalBatch + 12, IotJournalStats.Dropped);
+  size_t size = JOURNAL_HEADER_SIZE + count * sizeof(JournalRecord);
+
+  if(count > 0) {
+#ifdef IOT_TRANSPORT_MQTT
+    journalUploadFailed = !mqttPublishNow(MQTT_TOPIC_JOURNAL, journalBatch, size);
+    if(journalUploadFailed) {
+      IotJournalStats.UploadFailures++;
+      logd("Publishing the door journal failed.");
+      return;
+    }
+#else
+    HTTPClient& http = iotHttpBegin(JOURNAL_URL, 2000);
+    http.addHeader("Content-Type", "application/octet-stream");
+    int code = http.POST(journalBatch, size);
+    iotHttpEnd(code, size);
+
+    journalUploadFailed = (code != 200);
+    if(journalUploadFailed) {
+      IotJournalStats.UploadFailures++;
+      logd("Uploading the door journal failed, http code %d", code);
+      return;
+    }
+#endif
+    IotJournalStats.Uploaded += count;
+  }
+
+  journalAckedSeq = lastSeq;
+  journalBacklog = journalAckedSeq != journalWrittenSeq;
+  writePersistedFile(JOURNAL_ACK_FILE, JOURNAL_ACK_TMP, &journalAckedSeq, sizeof(journalAckedSeq));
+}
+
+// Called from loop().
+void serviceJournal() {
+  if(!journalReady) {
+    return;
+  }
+  if(journalPendingCount > 0) {
+    writeJournalPending();
+  }
+  if(journalWrittenSeq == journalAckedSeq) {
+    return;
+  }
+  unsigned long sinceMs = millis() - lastJournalUploadMs;
+  if(journalUploadFailed) {
+    if(sinceMs < JOURNAL_RETRY_MS) {
+      return;
+    }
+  }
+  else if(sinceMs < JOURNAL_UPLOAD_MS && !journalBacklog && journalWrittenSeq - journalAckedSeq < JOURNAL_NEAR_FULL) {
+    return; // more records may come for this batch
+  }
+#ifdef IOT_TRANSPORT_MQTT
+  if(!mqttConnected()) {
+    return;
+  }
+#else
+  if(!wifiConnected()) {
+    return;
+  }
+#endif
+  lastJournalUploadMs = millis();
+  uploadJournal();
+}
+
+size_t formatJournalMetrics(char* buff, size_t size) {
+  return snprintf(buff, size, "journal records=%lu unsent=%lu uploaded=%lu dropped=%lu failed=%lu",
+    IotJournalStats.Records, (unsigned long) (journalWrittenSeq - journalAckedSeq + journalPendingCount),
+    IotJournalStats.Uploaded, IotJournalStats.Dropped, IotJournalStats.UploadFailures);
+}
@@ -1,25 +1,10 @@
 #include <Arduino.h>
 #include <TimeLib.h>
+#include <limits.h>
 #include <main.h>
+#include <metrics.h>
 #include <pins.h>
 
-struct SensorOffData {
-  int Count = 0;
-  int MinValue = 1024;
-  int MaxValue = 0;
-
-  void Reset() {
-    Count = 0;
-    MinValue = 1024;
-    MaxValue = 0;
-  }
-};
-
-// Daily collection of out of range sensor values
-#define SENSOR_OFF_UNDER_CLOSED 0
-#define SENSOR_OFF_OVER_CLOSED 1
-SensorOffData SensorOffStat[2];
-
 char* formatMillis(char* buff, unsigned long milliseconds) {
   // returns the millisconds formatted as d.hh:mm:ss.lll
   unsigned long tmillis = milliseconds;
@@ -77,105 +62,19 @@ const char* getNamedDoorState(int doorState) {
   if(DOOR_OPEN <= doorState && doorState <= DOOR_AJAR) {
     return doorStateNames[doorState];
   }
-  return "Unknown";
-}
-
-#define SEND_SENSOR_OFF_STAT_INTERVAL (24 * 60 * 60 * 1000) // 24 hours
-unsigned long lastSensorOffStatSent = 0;
-void handleOutOfRangeValue(int rawVal) {
-
-  SensorOffData *psd;
-  if(rawVal < AppConfig.SensorRangeValues[DOOR_CLOSED][0]) {
-    // out of range below low value for door closed
-    psd = &SensorOffStat[SENSOR_OFF_UNDER_CLOSED];
-  }
-  else if(rawVal > AppConfig.SensorRangeValues[DOOR_CLOSED][1]) {
-    // out of range above high value for door closed
-    psd = &SensorOffStat[SENSOR_OFF_OVER_CLOSED];
-  }
-  else {
-    // Shouldn't end up here.
-    log("Out of range value %d was neither over of below.", rawVal);
-    return;
-  }
-
-  psd->Count++;
-  if(rawVal < psd->MinValue) {
-    psd->MinValue = rawVal;
-  }
-  if(rawVal > psd->MaxValue) {
-    psd->MaxValue = rawVal;
-  }
-
-  if(millis() - lastSensorOffStatSent > SEND_SENSOR_OFF_STAT_INTERVAL) {
-      //const char* logmsg =
-      log("Out of range sensor values: Over(%d [%d - %d]), Under(%d [%d - %d])."
-          , SensorOffStat[SENSOR_OFF_OVER_CLOSED].Count,  SensorOffStat[SENSOR_OFF_OVER_CLOSED].MinValue,  SensorOffStat[SENSOR_OFF_OVER_CLOSED].MaxValue
-          , SensorOffStat[SENSOR_OFF_UNDER_CLOSED].Count, SensorOffStat[SENSOR_OFF_UNDER_CLOSED].MinValue, SensorOffStat[SENSOR_OFF_UNDER_CLOSED].MaxValue
-        );
-      //sendNotification(IOT_EVENT_BAD_DATA, logmsg, -1);
-
-      SensorOffStat[SENSOR_OFF_OVER_CLOSED].Reset();
-      SensorOffStat[SENSOR_OFF_UNDER_CLOSED].Reset();
-
-      lastSensorOffStatSent = millis();
-  }
-}
-
-int getDoorState() {
-  int doorDebounceStates[AppConfig.DebounceReadCount] = { DOOR_UNKNOWN, DOOR_UNKNOWN, DOOR_UNKNOWN, DOOR_UNKNOWN, DOOR_UNKNOWN };
-
-  while(true) { // need to get a definitive answer
-
-    int rawVal = analogRead(POSITION_PIN);
-    logd("Position pin (%d) value: %d", POSITION_PIN, rawVal);
-
-    int doorState = DOOR_UNKNOWN;
-    for(int ndx = 0; ndx < DOOR_STATE_COUNT; ndx++) {
-      if(AppConfig.SensorRangeValues[ndx][0] <= rawVal && rawVal <= AppConfig.SensorRangeValues[ndx][1]) {
-        doorState = ndx;
-        break;
-      }
-    }
-
-    // debounce any value jitters
-    bool debounced = false;
-
-    if(doorState == DOOR_UNKNOWN) {
-      handleOutOfRangeValue(rawVal);
-    }
-    else {
-      // shift values left
-      for(int n = 0; n < AppConfig.DebounceReadCount - 1; n++) {
-        doorDebounceStates[n] = doorDebounceStates[n+1];
-      }
-      doorDebounceStates[AppConfig.DebounceReadCount - 1] = doorState;
-      // check for same consecutive values
-      logd("Debounce array:[%d %d %d %d %d]", doorDebounceStates[0], doorDebounceStates[1], doorDebounceStates[2], doorDebounceStates[3], doorDebounceStates[4]);
-      debounced = true;
-      for(int n = 0; n < AppConfig.DebounceReadCount - 1; n++) {
-        if(doorDebounceStates[n] != doorState) {
-          debounced = false;
-          break;
-        }
-      }
-    }
-
-    if(debounced) {
-      return doorState;
-    }
-
-    delay(AppConfig.DebounceReadPauseMs);
+  if(DOOR_UNSTABLE == doorState) {
+    return "Unstable";
   }
+  return "Unknown";
 }
 
-bool doorShouldBeClosed(unsigned long openSinceMs) {
+bool doorShouldBeClosed(int door, unsigned long openSinceMs) {
 
   if(openSinceMs != 0) {
     unsigned long doorOpenedForMs = millis() - openSinceMs;
     char buff[24];
 
-    logd("Door opened for %s. Min open time: %s. Max open time: %s", formatMillis(buff, doorOpenedForMs), AppConfig.txtMinOpenTime, AppConfig.txtMaxOpenTime);
+    logd("Door %d opened for %s. Min open time: %s. Max open time: %s", door, formatMillis(buff, doorOpenedForMs), AppConfig.txtMinOpenTime, AppConfig.txtMaxOpenTime);
     // if configured *don't close* the door if not opened min amount of time
     if(AppConfig.MinDoorOpenMs > 0 && doorOpenedForMs < AppConfig.MinDoorOpenMs) {
       return false;
@@ -189,130 +88,394 @@ bool doorShouldBeClosed(unsigned long openSinceMs) {
 
   // check time of day
   if(timeSet != timeStatus()) {
-    const char* logmsg = log("Door is staying open. Unreliable time.");
+    const char* logmsg = log("Door is staying open. Unreliable time, source: %s, error: %ld ms.",
+      getNamedTimeSource(IotTimeSync.Source), (long)timeErrorMs());
     sendNotification(IOT_EVENT_BAD_TIME, logmsg, -1);
     return false; // conservative choice
   }
 
-  bool shouldClose = false;
   time_t t = now();
-  int hhmm = hour(t) * 100 + minute(t);
-  int keepClosedFrom = AppConfig.KeepClosedFromTo[0];
-  int keepClosedTo = AppConfig.KeepClosedFromTo[1];
-  if(keepClosedFrom > keepClosedTo) {
-    // 2230 - 0600 - the usual case
-    shouldClose = keepClosedFrom <= hhmm || hhmm <= keepClosedTo;
-  }
-  else {
-    // 0900 - 1700
-    shouldClose = keepClosedFrom <= hhmm && hhmm <= keepClosedTo;
-  }
+  bool shouldClose = isKeepClosedTime(door, t);
 
-  logd("Door should close: %s. Current time: %d. Configured closed time interval: [%d - %d]", (shouldClose ? "yes" : "no"), hhmm, keepClosedFrom, keepClosedTo);
+  logd("Door %d should close: %s. Current time: %02d:%02d. Schedule changes in %ld minutes.",
+    door, (shouldClose ? "yes" : "no"), hour(t), minute(t), minutesToScheduleChange(door, t));
   return shouldClose;
 }
 
-void activateDoor() { // It is in fact toggle door. Calling this if door is closed will open it.
-  closingDoorAlarm();
+// Per door state, indexed by door.
+const uint8_t doorSwitchPins[] = { GDOOR_PIN, GDOOR2_PIN };
+unsigned long doorOpenedSinceMs[DOOR_COUNT];
+unsigned long lastCloseAttemptMs[DOOR_COUNT];
+int journaledDoorState[DOOR_COUNT];
+
+// Door closing is a state machine, advanced one step per loop() pass,
+// so closing never blocks the main loop. Each door has its own, they run side by side.
+// The alarm is shared: a door that starts closing while the other is alarming restarts it,
+// and both doors move once it is done.
+#define CLOSE_IDLE        0
+#define CLOSE_ALARMING    1 // sounding the alarm before moving the door
+#define CLOSE_PRESSING    2 // holding the door switch
+#define CLOSE_WAITING     3 // following the door as it moves, until it reads closed or DoorClosingTimeMs
+#define CLOSE_VERIFYING   4 // checking if the door closed
+#define CLOSE_RETRY       5 // starting a (next) closing attempt
+#define CLOSE_DONE        6
+
+#define CLOSE_MOTION_START_MS 5000 // an open door that hasn't left the open switch by then didn't get the press
+
+struct DoorClosing {
+  int State = CLOSE_IDLE;
+  int Attempt = 0;
+  unsigned long StepStartMs = 0;
+  int DoorState = DOOR_UNKNOWN;
+  bool Closed = false;
+  unsigned long PressMs = 0;  // switch pressed for the current attempt
+  bool Moved = false;         // the door settled in another state than it was pressed in
+  bool SlowReported = false;  // the close took longer than the learned travel time
+} Closing[DOOR_COUNT];
+
+bool isClosingDoor(int door) {
+  return CLOSE_IDLE != Closing[door].State;
+}
+
+bool isClosingDoor() {
+  for(int door = 0; door < DOOR_COUNT; door++) {
+    if(isClosingDoor(door)) {
+      return true;
+    }
+  }
+  return false;
+}
 
-  digitalWrite(GDOOR_PIN, HIGH);
-  delay(AppConfig.DoorClosingSwitchPressMs);
-  digitalWrite(GDOOR_PIN, LOW);
+void setClosingStep(int door, int state) {
+  Closing[door].State = state;
+  Closing[door].StepStartMs = millis();
 }
 
-bool closeDoor() {
+void startCloseDoor(int door) {
   // let's try to close the door
-  sendNotification(IOT_EVENT_AUTO_CLOSING_DOOR);
-  for(int attempt = 1; attempt <= AppConfig.MaxClosingTries; attempt++) {
-    logd("Door close try: %d.", attempt);
-    int doorState = getDoorState();
-    if(DOOR_CLOSED != doorState) {
-      activateDoor();
-    }
-    // give it time to close, and check
-    // if door hasn't closed, activating again will open the door.
-    logd("Waiting %d ms for door to move to closed position.", AppConfig.DoorClosingTimeMs);
-    delay(AppConfig.DoorClosingTimeMs);
-    doorState = getDoorState();
-    if(DOOR_CLOSED == doorState) {
-      log("Door is closed.");
-      sendNotification(IOT_EVENT_CLOSED_DOOR);
-      return true;
+  sendNotification(IOT_EVENT_AUTO_CLOSING_DOOR, NULL, 0, door);
+  Closing[door].Attempt = 1;
+  Closing[door].Closed = false;
+  setClosingStep(door, CLOSE_RETRY);
+}
+
+void finishCloseDoor(int door) {
+  DoorClosing& closing = Closing[door];
+  journalEvent(JOURNAL_CLOSE_RESULT, closing.Closed, closing.DoorState, door);
+  if(closing.Closed) {
+    log("Door %d is closed.", door);
+    sendNotification(IOT_EVENT_CLOSED_DOOR, NULL, 0, door);
+    lastCloseAttemptMs[door] = 0;
+    doorOpenedSinceMs[door] = 0;
+    return;
+  }
+
+  // door didn't close when it should've
+  lastCloseAttemptMs[door] = millis();
+  if(0 == lastCloseAttemptMs[door])
+    lastCloseAttemptMs[door] = 1; // don't want to mess up the 'flag' overload.
+
+  // notify
+  const char* logmsg = log("Door %d state: %s. Next attempt in %d minutes.", door,
+                    getNamedDoorState(closing.DoorState),
+                    (int) AppConfig.TimeBetweenClosingAttemptsMs / 1000 / 60);
+  sendNotification(IOT_EVENT_CLOSING_FAILURE, logmsg, -1, door);
+}
+
+void stepCloseDoor(int door) {
+  DoorClosing& closing = Closing[door];
+  unsigned long stepMs = millis() - closing.StepStartMs;
+
+  switch(closing.State) {
+    case CLOSE_RETRY:
+      if(closing.Attempt > AppConfig.MaxClosingTries) {
+        setClosingStep(door, CLOSE_DONE);
+        break;
+      }
+      closing.DoorState = getDoorState(door);
+      if(DOOR_UNSTABLE == closing.DoorState) {
+        // wait for the sensor to settle, moving a door in unknown position could open it
+        if(stepMs >= AppConfig.DoorClosingTimeMs) {
+          setClosingStep(door, CLOSE_DONE);
+        }
+        break;
+      }
+      logd("Door %d close try: %d.", door, closing.Attempt);
+      if(DOOR_CLOSED == closing.DoorState) {
+        setClosingStep(door, CLOSE_VERIFYING);
+        break;
+      }
+      // It is in fact toggle door. Activating it if door is closed will open it.
+      startClosingDoorAlarm();
+      setClosingStep(door, CLOSE_ALARMING);
+      break;
+
+    case CLOSE_ALARMING:
+      if(closingDoorAlarmDone()) {
+        // someone may have closed or moved it during the alarm, a press would then open or stop it
+        closing.DoorState = getDoorState(door);
+        if(DOOR_CLOSED == closing.DoorState) {
+          logd("Door %d closed during the alarm.", door);
+          setClosingStep(door, CLOSE_VERIFYING);
+          break;
+        }
+        if(DOOR_UNSTABLE == closing.DoorState) {
+          setClosingStep(door, CLOSE_RETRY);
+          break;
+        }
+        journalEvent(JOURNAL_CLOSE_ATTEMPT, closing.Attempt, closing.DoorState, door);
+        digitalWrite(doorSwitchPins[door], HIGH);
+        closing.PressMs = millis();
+        closing.Moved = false;
+        closing.SlowReported = false;
+        setClosingStep(door, CLOSE_PRESSING);
+      }
+      break;
+
+    case CLOSE_PRESSING:
+      if(stepMs >= AppConfig.DoorClosingSwitchPressMs) {
+        digitalWrite(doorSwitchPins[door], LOW);
+        // give it time to close, and check
+        // if door hasn't closed, activating again will open the door.
+        logd("Waiting up to %d ms for door %d to move to closed position.", AppConfig.DoorClosingTimeMs, door);
+        setClosingStep(door, CLOSE_WAITING);
+      }
+      break;
+
+    case CLOSE_WAITING: {
+      // The sensor is sampled all along, so the door is checked as it moves instead of once
+      // at the end: done as soon as it reads closed, or when an open door never left the open switch.
+      // Anything else waits for DoorClosingTimeMs, a press on a door still moving would stop or reverse it.
+      int doorState = getDoorState(door);
+      unsigned long travelMs = millis() - closing.PressMs;
+      unsigned long limitMs = travelLimitMs(door);
+      if(!closing.Moved && doorState >= 0 && doorState != closing.DoorState) {
+        closing.Moved = true;
+        logd("Door %d moved to %s after %lu ms.", door, getNamedDoorState(doorState), travelMs);
+      }
+      if(DOOR_OPEN == closing.DoorState && !closing.SlowReported && limitMs != 0 && travelMs > limitMs) {
+        reportSlowDoor(door, travelMs);
+        closing.SlowReported = true;
+      }
+
+      if(DOOR_CLOSED == doorState) {
+        if(DOOR_OPEN == closing.DoorState) {
+          recordDoorTravel(door, travelMs, closing.SlowReported); // a whole travel, from the open switch
+        }
+        setClosingStep(door, CLOSE_VERIFYING);
+      }
+      else if(stepMs >= AppConfig.DoorClosingTimeMs) {
+        setClosingStep(door, CLOSE_VERIFYING);
+      }
+      else if(DOOR_OPEN == closing.DoorState && !closing.Moved && travelMs >= CLOSE_MOTION_START_MS) {
+        log("Door %d didn't move.", door);
+        setClosingStep(door, CLOSE_VERIFYING);
+      }
+      break;
     }
+
+    case CLOSE_VERIFYING:
+      closing.DoorState = getDoorState(door);
+      if(DOOR_UNSTABLE == closing.DoorState && stepMs < AppConfig.DoorClosingTimeMs) {
+        break; // the door may still be settling
+      }
+      if(DOOR_CLOSED == closing.DoorState) {
+        closing.Closed = true;
+        setClosingStep(door, CLOSE_DONE);
+        break;
+      }
+      closing.Attempt++;
+      setClosingStep(door, CLOSE_RETRY);
+      break;
+
+    case CLOSE_DONE:
+      finishCloseDoor(door);
+      setClosingStep(door, CLOSE_IDLE);
+      break;
   }
+}
 
-  return false;
+// Advances the doors that are closing, called on every loop() pass.
+void stepClosingDoors() {
+  for(int door = 0; door < DOOR_COUNT; door++) {
+    if(isClosingDoor(door)) {
+      stepCloseDoor(door);
+    }
+  }
 }
 
-unsigned long doorOpenedSinceMs = 0;
-unsigned long lastCloseAttemptMs = 0;
+void checkDoor(int door) {
+  if(isClosingDoor(door)) {
+    return; // stepped on every pass
+  }
 
-void checkDoor() {
-  int doorState = getDoorState();
-  logd("Door state: %d", doorState);
+  int doorState = getDoorState(door);
+  publishDoorState(door, doorState);
+  logd("Position pin (%d) value: %d, door %d", POSITION_PIN, getSensorValue(door), door);
+  logd("Door %d state: %d", door, doorState);
+  if(DOOR_UNSTABLE == doorState) {
+    return; // no decisions until the readings settle
+  }
+  if(doorState != journaledDoorState[door]) {
+    journalEvent(JOURNAL_DOOR_STATE, doorState, getSensorValue(door), door);
+    journaledDoorState[door] = doorState;
+  }
 
   if(DOOR_CLOSED == doorState) {
-    if(lastCloseAttemptMs != 0) {
+    if(lastCloseAttemptMs[door] != 0) {
       // door was found closed, when previously it had failed to.
-      sendNotification(IOT_EVENT_CLOSED_DOOR);
+      sendNotification(IOT_EVENT_CLOSED_DOOR, NULL, 0, door);
     }
-    lastCloseAttemptMs = 0;
-    doorOpenedSinceMs = 0;
+    lastCloseAttemptMs[door] = 0;
+    doorOpenedSinceMs[door] = 0;
     return;
   }
 
   // Door is not closed
-  if(0 == doorOpenedSinceMs) {
+  if(0 == doorOpenedSinceMs[door]) {
     // Door was just found open. Mark the time.
-    doorOpenedSinceMs = millis();
-    if(0 == doorOpenedSinceMs) {
-      doorOpenedSinceMs = 1; // 0 is our magic number.
+    doorOpenedSinceMs[door] = millis();
+    if(0 == doorOpenedSinceMs[door]) {
+      doorOpenedSinceMs[door] = 1; // 0 is our magic number.
     }
     return;
   }
 
-  if(!doorShouldBeClosed(doorOpenedSinceMs)) {
-    lastCloseAttemptMs = 0;
+  if(!doorShouldBeClosed(door, doorOpenedSinceMs[door])) {
+    lastCloseAttemptMs[door] = 0;
     return;
   }
 
-  if(lastCloseAttemptMs != 0 && millis() - lastCloseAttemptMs < AppConfig.TimeBetweenClosingAttemptsMs) {
-    logd("Too soon to try and close door again. ");
+  if(lastCloseAttemptMs[door] != 0 && millis() - lastCloseAttemptMs[door] < AppConfig.TimeBetweenClosingAttemptsMs) {
+    logd("Too soon to try and close door %d again. ", door);
     return;
   }
 
   if(!AppConfig.EnableControl) {
     logd("Door control is disabled.");
     char buff[24];
-    const char* logmsg = log("Door has been opened for %s", formatMillis(buff, (millis() - doorOpenedSinceMs)));
-    sendNotification(IOT_EVENT_CONTROL_DISABLED, logmsg, -1);
+    const char* logmsg = log("Door %d has been opened for %s", door, formatMillis(buff, (millis() - doorOpenedSinceMs[door])));
+    sendNotification(IOT_EVENT_CONTROL_DISABLED, logmsg, -1, door);
     return;
   }
 
-  bool doorClosed = closeDoor();
-  if(doorClosed) {
-    lastCloseAttemptMs = 0;
-    doorOpenedSinceMs = 0;
-    return;
+  startCloseDoor(door);
+}
+
+// One pass over all the doors. Sampling runs in the background, so a pass doesn't wait on any door.
+void checkDoor() {
+  for(int door = 0; door < DOOR_COUNT; door++) {
+    checkDoor(door);
   }
+}
 
-  // door didn't close when it should've
-  lastCloseAttemptMs = millis();
-  if(0 == lastCloseAttemptMs)
-    lastCloseAttemptMs = 1; // don't want to mess up the 'flag' overload.
+// Door check cadence. Checks are fast while a door moves or its readings change, every MainLoopMs
+// while a door is open, and back off to MainLoopIdleMs once all doors have been closed for a while.
+// Sensor activity brings the next check forward at any cadence, and an open door's next decision
+// point (min and max open time, next close attempt, schedule change) cuts the interval short.
+#define CADENCE_ACTIVE_MS   (30UL * 1000)     // fast checks for this long after sensor activity
+#define CADENCE_SETTLE_MS   (5UL * 60 * 1000) // closed for this long before checks go idle
+#define LOOP_IDLE_SLEEP_MS  50                // per pass when idle, lets the modem sleep
 
-  // notify
-  const char* logmsg = log("Door state: %s. Next attempt in %d minutes.",
-                    getNamedDoorState(doorState),
-                    (int) AppConfig.TimeBetweenClosingAttemptsMs / 1000 / 60);
-  sendNotification(IOT_EVENT_CLOSING_FAILURE, logmsg, -1);
+CadenceStats IotCadence;
+unsigned long lastDoorActivityMs[DOOR_COUNT];
+unsigned long lastDoorCheckMs = 0;
+
+const char* cadenceNames[] = { "fast", "normal", "idle" };
+
+// Time until dueMs, or ULONG_MAX if it has passed: a passed deadline has had its check.
+unsigned long msUntil(unsigned long dueMs) {
+  long left = (long)(dueMs - millis());
+  return left > 0 ? left : ULONG_MAX;
+}
+
+unsigned long nextDoorDecisionMs(int door) {
+  unsigned long untilMs = ULONG_MAX;
+  if(doorOpenedSinceMs[door] != 0) {
+    if(AppConfig.MinDoorOpenMs > 0) {
+      untilMs = min(untilMs, msUntil(doorOpenedSinceMs[door] + AppConfig.MinDoorOpenMs));
+    }
+    if(AppConfig.MaxDoorOpenMs > 0) {
+      untilMs = min(untilMs, msUntil(doorOpenedSinceMs[door] + AppConfig.MaxDoorOpenMs + 1));
+    }
+  }
+  if(lastCloseAttemptMs[door] != 0) {
+    untilMs = min(untilMs, msUntil(lastCloseAttemptMs[door] + AppConfig.TimeBetweenClosingAttemptsMs));
+  }
+  if(timeSet == timeStatus()) {
+    time_t t = now();
+    long minutes = minutesToScheduleChange(door, t);
+    if(minutes > 0) {
+      untilMs = min(untilMs, (minutes * 60 - second(t)) * 1000UL);
+    }
+  }
+  return untilMs;
+}
+
+int doorCadence(int door) {
+  int doorState = getDoorState(door);
+  if(DOOR_UNSTABLE == doorState || millis() - lastDoorActivityMs[door] < CADENCE_ACTIVE_MS) {
+    return CADENCE_FAST;
+  }
+  if(DOOR_CLOSED == doorState && millis() - lastDoorActivityMs[door] >= CADENCE_SETTLE_MS) {
+    return CADENCE_IDLE;
+  }
+  return CADENCE_NORMAL;
+}
+
+// Called after each door check.
+void planDoorCheck() {
+  const unsigned long intervals[] = { AppConfig.MainLoopFastMs, AppConfig.MainLoopMs, AppConfig.MainLoopIdleMs };
+  int cadence = CADENCE_IDLE;
+  unsigned long decisionMs = ULONG_MAX;
+  for(int door = 0; door < DOOR_COUNT; door++) {
+    cadence = min(cadence, doorCadence(door));
+    if(DOOR_CLOSED != getDoorState(door)) {
+      decisionMs = min(decisionMs, nextDoorDecisionMs(door));
+    }
+  }
+
+  unsigned long intervalMs = intervals[cadence];
+  if(decisionMs < intervalMs) {
+    intervalMs = max(decisionMs, AppConfig.MainLoopFastMs);
+    IotCadence.DeadlineWakes++;
+  }
+  if(cadence != IotCadence.Cadence) {
+    logd("Door checks %s, every %lu ms.", cadenceNames[cadence], intervals[cadence]);
+  }
+  IotCadence.Cadence = cadence;
+  IotCadence.IntervalMs = intervalMs;
+  IotCadence.Checks[cadence]++;
+}
+
+bool doorCheckDue() {
+  uint8_t active = takeSensorActivity();
+  if(active != 0) {
+    for(int door = 0; door < DOOR_COUNT; door++) {
+      if(active & (1 << door)) {
+        lastDoorActivityMs[door] = millis();
+      }
+    }
+    IotCadence.SensorWakes++;
+    return true;
+  }
+  return millis() - lastDoorCheckMs >= IotCadence.IntervalMs;
+}
+
+size_t formatCadenceMetrics(char* buff, size_t size) {
+  return snprintf(buff, size, "cadence now=%s interval=%lu ms checks fast=%lu normal=%lu idle=%lu wakes sensor=%lu deadline=%lu",
+    cadenceNames[IotCadence.Cadence], IotCadence.IntervalMs, IotCadence.Checks[CADENCE_FAST],
+    IotCadence.Checks[CADENCE_NORMAL], IotCadence.Checks[CADENCE_IDLE], IotCadence.SensorWakes, IotCadence.DeadlineWakes);
 }
 
 void setupIO() {
 
   pinMode(POSITION_PIN, INPUT);
 
-  pinMode(GDOOR_PIN, OUTPUT);
+  for(int door = 0; door < DOOR_COUNT; door++) {
+    pinMode(doorSwitchPins[door], OUTPUT);
+    journaledDoorState[door] = DOOR_UNKNOWN;
+  }
   pinMode(BUZZER_PIN, OUTPUT);
 
   pinMode(LED_BLUE_PIN, OUTPUT);
@@ -329,44 +492,73 @@ void setup() {
   log("\nSetting up...");
 
   setupIO();
-  ensureWiFi();
+  restorePersisted();
+  startJournal();
+  journalEvent(JOURNAL_RESET, 0);
+  startSensorSampling();
+  startWiFi();
 
+  startTimeSync();
   updateConfig(true);
+  sendNotification(IOT_EVENT_RESET);
+  startStatusServer();
+  startMqtt();
 
   log("Ready. Version: " GDOOR_MONITOR_VERSION);
 }
 
 unsigned long lastLoopRun = 0;
-bool resetNotificationSent = false;
-bool flipLedOnOff = false;
 void loop() {
+  {
+    TIME_STAGE(STAGE_LOOP);
+
+    serviceWiFi();
+    unsigned long now = millis();
+    if(now - lastLoopRun > AppConfig.MainLoopMs) {
 
-  unsigned long now = millis();
-  if(now - lastLoopRun > AppConfig.MainLoopMs) {
+      {
+        TIME_STAGE(STAGE_CONFIG);
+        updateConfig();
+      }
+      serviceSensor();
+      updateStatusLed();
+      reportMetrics();
 
-    if(!resetNotificationSent) {
-      // Here because sometimes wifi is not ready in startup.
-      resetNotificationSent = sendNotification(IOT_EVENT_RESET);
+      lastLoopRun = now;
     }
 
-    updateConfig();
-    checkDoor();
+    bool checkDue = doorCheckDue();
+    if(checkDue || isClosingDoor()) {
+      TIME_STAGE(STAGE_CHECK_DOOR);
+      stepClosingDoors(); // keep the door closing going on every pass
+      if(checkDue) {
+        checkDoor();
+        lastDoorCheckMs = now;
+        planDoorCheck();
+      }
+    }
 
-    // Blink red/blue LED based on WiFi state
-    int ledPin;
-    if(wifiConnected()) {
-      digitalWrite(LED_RED_PIN, 1); // off
-      ledPin = LED_BLUE_PIN;
+    {
+      TIME_STAGE(STAGE_NOTIFY);
+      processNotifications();
     }
-    else{
-      digitalWrite(LED_BLUE_PIN, 1);
-      ledPin = LED_RED_PIN;
+    {
+      TIME_STAGE(STAGE_LOG);
+      logRawSensorSamples();
+      flushLog();
+      flushBinaryLog();
     }
-    digitalWrite(ledPin, flipLedOnOff ? 0 : 1);
-    flipLedOnOff = !flipLedOnOff;
-
-    lastLoopRun = now;
+    serviceStatusServer();
+    serviceMqtt();
+    serviceTimeSync();
+    servicePersist();
+    serviceJournal();
   }
 
-  yield();
+  if(CADENCE_IDLE == IotCadence.Cadence && !isClosingDoor()) {
+    delay(LOOP_IDLE_SLEEP_MS);
+  }
+  else {
+    yield();
+  }
 }
@@ -0,0 +1,130 @@
+#include <Arduino.h>
+#include <main.h>
+#include <metrics.h>
+
+LatencyHistogram StageLatency[STAGE_COUNT];
+
+const char* stageNames[STAGE_COUNT] = {
+  "loop",
+  "config",
+  "door",
+  "notify",
+  "log",
+  "connect"
+};
+
+void LatencyHistogram::add(uint32_t us) {
+  int bucket = 0;
+  for(uint32_t v = us; v > 1 && bucket < LATENCY_BUCKETS - 1; v >>= 1) {
+    bucket++;
+  }
+  Buckets[bucket]++;
+  if(0 == Count || us < MinUs) {
+    MinUs = us;
+  }
+  if(us > MaxUs) {
+    MaxUs = us;
+  }
+  Count++;
+}
+
+// Interpolates within the bucket holding the p-th percentile.
+uint32_t LatencyHistogram::percentile(int p) const {
+  if(0 == Count) {
+    return 0;
+  }
+  uint32_t rank = (uint64_t) Count * p / 100;
+  uint32_t seen = 0;
+  for(int b = 0; b < LATENCY_BUCKETS; b++) {
+    if(seen + Buckets[b] > rank) {
+      uint32_t low = b == 0 ? 0 : 1UL << b;
+      uint32_t high = 1UL << (b + 1);
+      uint32_t us = low + (uint64_t)(high - low) * (rank - seen) / Buckets[b];
+      return constrain(us, MinUs, MaxUs);
+    }
+    seen += Buckets[b];
+  }
+  return MaxUs;
+}
+
+void LatencyHistogram::reset() {
+  memset(this, 0, sizeof(*this));
+}
+
+size_t formatStageMetrics(char* buff, size_t size, int stage) {
+  const LatencyHistogram& h = StageLatency[stage];
+  return snprintf(buff, size, "%s n=%lu min=%lu p50=%lu p99=%lu max=%lu us",
+    stageNames[stage], (unsigned long) h.Count, (unsigned long) h.MinUs,
+    (unsigned long) h.percentile(50), (unsigned long) h.percentile(99), (unsigned long) h.MaxUs);
+}
+
+size_t formatHttpMetrics(char* buff, size_t size) {
+  return snprintf(buff, size, "http requests=%lu reused=%lu failed=%lu sent=%lu bytes",
+    IotHttpStats.Requests, IotHttpStats.Reused, IotHttpStats.Failures, IotHttpStats.BytesSent);
+}
+
+// All the metrics, one line each. Returns size or more when they didn't fit.
+size_t formatMetrics(char* buff, size_t size) {
+  size_t len = 0;
+  for(int stage = 0; stage < STAGE_COUNT && len < size; stage++) {
+    len += formatStageMetrics(buff + len, size - len, stage);
+    if(len < size - 1) {
+      buff[len++] = '\n';
+    }
+  }
+  if(len < size) {
+    len += formatHttpMetrics(buff + len, size - len);
+  }
+  if(len < size - 1) {
+    buff[len++] = '\n';
+    len += formatTimeMetrics(buff + len, size - len);
+  }
+  if(len < size - 1) {
+    buff[len++] = '\n';
+    len += formatWiFiMetrics(buff + len, size - len);
+  }
+  if(len < size - 1) {
+    buff[len++] = '\n';
+    len += formatJournalMetrics(buff + len, size - len);
+  }
+  for(int door = 0; door < DOOR_COUNT && len < size - 1; door++) {
+    buff[len++] = '\n';
+    len += formatTravelMetrics(buff + len, size - len, door);
+  }
+  if(len < size - 1) {
+    buff[len++] = '\n';
+    len += formatCadenceMetrics(buff + len, size - len);
+  }
+  return len < size - 1 ? len : size;
+}
+
+unsigned long lastMetricsReport = 0;
+
+// Logs the metrics every MetricsReportMs and starts over.
+void reportMetrics() {
+  if(0 == AppConfig.MetricsReportMs || millis() - lastMetricsReport < AppConfig.MetricsReportMs) {
+    return;
+  }
+  lastMetricsReport = millis();
+
+  char line[120];
+  for(int stage = 0; stage < STAGE_COUNT; stage++) {
+    formatStageMetrics(line, sizeof(line), stage);
+    log("Metrics: %s", line);
+    StageLatency[stage].reset();
+  }
+  formatHttpMetrics(line, sizeof(line));
+  log("Metrics: %s", line);
+  formatTimeMetrics(line, sizeof(line));
+  log("Metrics: %s", line);
+  formatWiFiMetrics(line, sizeof(line));
+  log("Metrics: %s", line);
+  formatJournalMetrics(line, sizeof(line));
+  log("Metrics: %s", line);
+  for(int door = 0; door < DOOR_COUNT; door++) {
+    formatTravelMetrics(line, sizeof(line), door);
+    log("Metrics: %s", line);
+  }
+  formatCadenceMetrics(line, sizeof(line));
+  log("Metrics: %s", line);
+}
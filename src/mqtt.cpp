@@ -0,0 +1,179 @@
+#include <Arduino.h>
+#include <main.h>
+
+#ifdef IOT_TRANSPORT_MQTT
+
+#include <ESP8266WiFi.h>
+#include <PubSubClient.h>
+
+// MQTT transport, built with -D IOT_TRANSPORT_MQTT.
+// One persistent session: events, log batches and door state go out as publishes,
+// and the config arrives on a retained topic instead of being polled.
+// Messages published while disconnected wait in a small outbox. Senders that keep
+// their messages until sent (notifications, the journal) publish without it.
+
+#ifndef MQTT_BROKER
+#define MQTT_BROKER     IOT_SERVICE_FQDN
+#endif
+#ifndef MQTT_PORT
+#define MQTT_PORT       1883
+#endif
+#ifndef MQTT_USER
+#define MQTT_USER       NULL
+#define MQTT_PASSWORD   NULL
+#endif
+
+#define MQTT_TOPIC_BASE       DEVICE_ID "/"
+#define MQTT_RECONNECT_MS     (5 * 1000)
+#define MQTT_PACKET_SIZE      (MQTT_MAX_PAYLOAD + 128) // fixed header and topic
+#define MQTT_OUTBOX_SIZE      2048
+
+static_assert(MQTT_MAX_PAYLOAD + 4 <= MQTT_OUTBOX_SIZE, "the largest message must fit in the outbox");
+
+const char* mqttTopics[] = {
+  MQTT_TOPIC_BASE "event",
+  MQTT_TOPIC_BASE "log",
+  MQTT_TOPIC_BASE "state",
+  MQTT_TOPIC_BASE "status",
+  MQTT_TOPIC_BASE "log/bin",
+  MQTT_TOPIC_BASE "journal",
+  MQTT_TOPIC_BASE "state/1"
+};
+#define MQTT_TOPIC_CONFIG     MQTT_TOPIC_BASE "config"
+
+// Door 0 on "state", door 1 on "state/1".
+const int doorStateTopics[] = { MQTT_TOPIC_STATE, MQTT_TOPIC_STATE1 };
+int lastPublishedDoorState[DOOR_COUNT];
+
+WiFiClient mqttWifiClient;
+PubSubClient mqttClient(mqttWifiClient);
+unsigned long lastMqttConnectTry = 0;
+
+// Outbox records: topic (1 byte), retained (1 byte), length (2 bytes), payload.
+// When full, the oldest records are dropped.
+uint8_t mqttOutbox[MQTT_OUTBOX_SIZE];
+size_t mqttOutboxLen = 0;
+unsigned long mqttMessagesDropped = 0;
+
+void dropOldestMqttMessage() {
+  size_t recLen = 4 + (mqttOutbox[2] | (mqttOutbox[3] << 8));
+  memmove(mqttOutbox, mqttOutbox + recLen, mqttOutboxLen - recLen);
+  mqttOutboxLen -= recLen;
+  mqttMessagesDropped++;
+}
+
+void queueMqttMessage(int topic, const uint8_t* payload, size_t len, bool retained) {
+  if(len > MQTT_MAX_PAYLOAD) {
+    mqttMessagesDropped++; // would never go through the packet buffer
+    return;
+  }
+  while(mqttOutboxLen + len + 4 > MQTT_OUTBOX_SIZE) {
+    dropOldestMqttMessage();
+  }
+  uint8_t* rec = mqttOutbox + mqttOutboxLen;
+  rec[0] = topic;
+  rec[1] = retained;
+  rec[2] = len & 0xff;
+  rec[3] = len >> 8;
+  memcpy(rec + 4, payload, len);
+  mqttOutboxLen += len + 4;
+}
+
+void flushMqttOutbox() {
+  while(mqttOutboxLen > 0 && mqttClient.connected()) {
+    size_t len = mqttOutbox[2] | (mqttOutbox[3] << 8);
+    if(!mqttClient.publish(mqttTopics[mqttOutbox[0]], mqttOutbox + 4, len, mqttOutbox[1])) {
+      if(!mqttClient.connected()) {
+        return; // sent after the reconnect
+      }
+      dropOldestMqttMessage(); // refused while connected, it won't go through on a retry either
+      continue;
+    }
+    size_t recLen = 4 + len;
+    memmove(mqttOutbox, mqttOutbox + recLen, mqttOutboxLen - recLen);
+    mqttOutboxLen -= recLen;
+  }
+}
+
+// Returns false when the message only went to the outbox, or was dropped.
+bool mqttPublish(int topic, const uint8_t* payload, size_t len, bool retained) {
+  if(0 == mqttOutboxLen && mqttPublishNow(topic, payload, len, retained)) {
+    return true;
+  }
+  queueMqttMessage(topic, payload, len, retained);
+  return false;
+}
+
+// Publishes right away or not at all, the caller keeps the message to retry.
+bool mqttPublishNow(int topic, const uint8_t* payload, size_t len, bool retained) {
+  return len <= MQTT_MAX_PAYLOAD && mqttClient.connected() && mqttClient.publish(mqttTopics[topic], payload, len, retained);
+}
+
+void onMqttMessage(char* topic, uint8_t* payload, unsigned int length) {
+  if(0 == strcmp(topic, MQTT_TOPIC_CONFIG)) {
+    applyPushedConfig((const char*) payload, length);
+  }
+}
+
+void connectMqtt() {
+  // persistent session (no clean session), so the config subscription survives reconnects
+  const char* offline = "offline";
+  if(!mqttClient.connect(DEVICE_ID, MQTT_USER, MQTT_PASSWORD,
+      mqttTopics[MQTT_TOPIC_STATUS], 1, true, offline, false)) {
+    logd("MQTT connect to %s failed, state %d.", MQTT_BROKER, mqttClient.state());
+    return;
+  }
+  log("MQTT connected to %s.", MQTT_BROKER);
+  mqttClient.subscribe(MQTT_TOPIC_CONFIG, 1);
+  const char* online = "online";
+  mqttClient.publish(mqttTopics[MQTT_TOPIC_STATUS], online, true);
+  if(mqttMessagesDropped > 0) {
+    log("%lu MQTT messages dropped.", mqttMessagesDropped);
+    mqttMessagesDropped = 0;
+  }
+  flushMqttOutbox();
+}
+
+void startMqtt() {
+  mqttClient.setServer(MQTT_BROKER, MQTT_PORT);
+  mqttClient.setBufferSize(MQTT_PACKET_SIZE);
+  mqttClient.setCallback(onMqttMessage);
+  for(int door = 0; door < DOOR_COUNT; door++) {
+    lastPublishedDoorState[door] = DOOR_UNKNOWN;
+  }
+}
+
+void serviceMqtt() {
+  if(!mqttClient.connected()) {
+    if(!wifiConnected() || millis() - lastMqttConnectTry < MQTT_RECONNECT_MS) {
+      return;
+    }
+    lastMqttConnectTry = millis();
+    connectMqtt();
+    return;
+  }
+  mqttClient.loop();
+  flushMqttOutbox();
+}
+
+bool mqttConnected() {
+  return mqttClient.connected();
+}
+
+void publishDoorState(int door, int doorState) {
+  if(doorState == lastPublishedDoorState[door] || DOOR_UNSTABLE == doorState) {
+    return;
+  }
+  lastPublishedDoorState[door] = doorState;
+  const char* name = getNamedDoorState(doorState);
+  mqttPublish(doorStateTopics[door], (const uint8_t*) name, strlen(name), true);
+}
+
+#else
+
+void startMqtt() {}
+void serviceMqtt() {}
+void publishDoorState(int door, int doorState) {}
+bool mqttConnected() { return false; }
+
+#endif // IOT_TRANSPORT_MQTT
@@ -0,0 +1,300 @@
+#include <Arduino.h>
+#include <msgpack.h>
+
+void MsgPackWriter::put(uint8_t b) {
+  if(_len >= _size) {
+    _overflow = true;
+    return;
+  }
+  _buff[_len++] = b;
+}
+
+void MsgPackWriter::putBE(uint32_t v, int bytes) {
+  for(int n = bytes - 1; n >= 0; n--) {
+    put((v >> (8 * n)) & 0xff);
+  }
+}
+
+void MsgPackWriter::writeNil() {
+  put(0xc0);
+}
+
+void MsgPackWriter::writeBool(bool b) {
+  put(b ? 0xc3 : 0xc2);
+}
+
+void MsgPackWriter::writeInt(long v) {
+  if(v >= 0) {
+    writeUint(v);
+  }
+  else if(v >= -32) {
+    put((uint8_t)v);      // negative fixint
+  }
+  else if(v >= -128) {
+    put(0xd0);
+    putBE((uint8_t)v, 1);
+  }
+  else if(v >= -32768) {
+    put(0xd1);
+    putBE((uint16_t)v, 2);
+  }
+  else {
+    put(0xd2);
+    putBE((uint32_t)v, 4);
+  }
+}
+
+void MsgPackWriter::writeUint(unsigned long v) {
+  if(v < 0x80) {
+    put(v);               // positive fixint
+  }
+  else if(v <= 0xff) {
+    put(0xcc);
+    putBE(v, 1);
+  }
+  else if(v <= 0xffff) {
+    put(0xcd);
+    putBE(v, 2);
+  }
+  else {
+    put(0xce);
+    putBE(v, 4);
+  }
+}
+
+void MsgPackWriter::writeStr(const char* s, size_t len) {
+  if(len < 32) {
+    put(0xa0 | len);
+  }
+  else if(len <= 0xff) {
+    put(0xd9);
+    putBE(len, 1);
+  }
+  else {
+    put(0xda);
+    putBE(len, 2);
+  }
+  for(size_t n = 0; n < len; n++) {
+    put(s[n]);
+  }
+}
+
+void MsgPackWriter::writeArray(size_t count) {
+  if(count < 16) {
+    put(0x90 | count);
+  }
+  else {
+    put(0xdc);
+    putBE(count, 2);
+  }
+}
+
+void MsgPackWriter::writeMap(size_t count) {
+  if(count < 16) {
+    put(0x80 | count);
+  }
+  else {
+    put(0xde);
+    putBE(count, 2);
+  }
+}
+
+bool MsgPackReader::get(uint8_t& b) {
+  if(_pos >= _len) {
+    return fail();
+  }
+  b = _data[_pos++];
+  return true;
+}
+
+bool MsgPackReader::getBE(uint32_t& v, int bytes) {
+  v = 0;
+  for(int n = 0; n < bytes; n++) {
+    uint8_t b;
+    if(!get(b)) {
+      return false;
+    }
+    v = (v << 8) | b;
+  }
+  return true;
+}
+
+int MsgPackReader::peekType() {
+  if(_pos >= _len) {
+    return MSGPACK_OTHER;
+  }
+  uint8_t b = _data[_pos];
+  if(b <= 0x7f || b >= 0xe0 || (b >= 0xcc && b <= 0xce) || (b >= 0xd0 && b <= 0xd2)) {
+    return MSGPACK_INT;
+  }
+  if((b & 0xe0) == 0xa0 || (b >= 0xd9 && b <= 0xdb)) {
+    return MSGPACK_STR;
+  }
+  if((b & 0xf0) == 0x90 || b == 0xdc || b == 0xdd) {
+    return MSGPACK_ARRAY;
+  }
+  if((b & 0xf0) == 0x80 || b == 0xde || b == 0xdf) {
+    return MSGPACK_MAP;
+  }
+  if(b == 0xc0) {
+    return MSGPACK_NIL;
+  }
+  if(b == 0xc2 || b == 0xc3) {
+    return MSGPACK_BOOL;
+  }
+  return MSGPACK_OTHER;
+}
+
+bool MsgPackReader::readNil() {
+  uint8_t b;
+  return get(b) && (b == 0xc0 || fail());
+}
+
+bool MsgPackReader::readBool(bool& v) {
+  uint8_t b;
+  if(!get(b)) {
+    return false;
+  }
+  if(b == 0xc2 || b == 0xc3) {
+    v = (b == 0xc3);
+    return true;
+  }
+  if(b <= 0x01) {
+    v = b;                // accept 0 and 1 as well, like the json config does
+    return true;
+  }
+  return fail();
+}
+
+bool MsgPackReader::readInt(long& v) {
+  uint8_t b;
+  uint32_t u;
+  if(!get(b)) {
+    return false;
+  }
+  if(b <= 0x7f) {
+    v = b;
+    return true;
+  }
+  if(b >= 0xe0) {
+    v = (int8_t)b;
+    return true;
+  }
+  switch(b) {
+    case 0xcc: if(!getBE(u, 1)) return false; v = u; return true;
+    case 0xcd: if(!getBE(u, 2)) return false; v = u; return true;
+    case 0xce: if(!getBE(u, 4)) return false; v = (long)u; return true;
+    case 0xd0: if(!getBE(u, 1)) return false; v = (int8_t)u; return true;
+    case 0xd1: if(!getBE(u, 2)) return false; v = (int16_t)u; return true;
+    case 0xd2: if(!getBE(u, 4)) return false; v = (int32_t)u; return true;
+  }
+  return fail();
+}
+
+bool MsgPackReader::readStr(const char*& s, size_t& len) {
+  uint8_t b;
+  uint32_t u;
+  if(!get(b)) {
+    return false;
+  }
+  if((b & 0xe0) == 0xa0) {
+    u = b & 0x1f;
+  }
+  else if(b < 0xd9 || b > 0xdb || !getBE(u, 1 << (b - 0xd9))) {
+    return fail();
+  }
+  if(u > _len - _pos) {
+    return fail();
+  }
+  s = (const char*)_data + _pos;
+  len = u;
+  _pos += u;
+  return true;
+}
+
+bool MsgPackReader::readArray(size_t& count) {
+  uint8_t b;
+  uint32_t u;
+  if(!get(b)) {
+    return false;
+  }
+  if((b & 0xf0) == 0x90) {
+    count = b & 0x0f;
+    return true;
+  }
+  if((b != 0xdc && b != 0xdd) || !getBE(u, b == 0xdc ? 2 : 4)) {
+    return fail();
+  }
+  count = u;
+  return true;
+}
+
+bool MsgPackReader::readMap(size_t& count) {
+  uint8_t b;
+  uint32_t u;
+  if(!get(b)) {
+    return false;
+  }
+  if((b & 0xf0) == 0x80) {
+    count = b & 0x0f;
+    return true;
+  }
+  if((b != 0xde && b != 0xdf) || !getBE(u, b == 0xde ? 2 : 4)) {
+    return fail();
+  }
+  count = u;
+  return true;
+}
+
+// Recursive: the depth is limited, a small body of nested arrays would otherwise overflow the stack.
+bool MsgPackReader::skip(int depth) {
+  size_t count;
+  const char* s;
+  size_t len;
+  long v;
+  bool bv;
+  switch(peekType()) {
+    case MSGPACK_NIL: return readNil();
+    case MSGPACK_BOOL: return readBool(bv);
+    case MSGPACK_INT: return readInt(v);
+    case MSGPACK_STR: return readStr(s, len);
+    case MSGPACK_ARRAY:
+      if(depth >= MSGPACK_MAX_DEPTH || !readArray(count)) return fail();
+      while(count-- > 0) if(!skip(depth + 1)) return false;
+      return true;
+    case MSGPACK_MAP:
+      if(depth >= MSGPACK_MAX_DEPTH || !readMap(count)) return fail();
+      while(count-- > 0) if(!skip(depth + 1) || !skip(depth + 1)) return false;
+      return true;
+  }
+
+  // 64 bit integers, floats, bin, ext: not used by the device
+  uint8_t b;
+  uint32_t u = 0;
+  if(!get(b)) {
+    return false;
+  }
+  switch(b) {
+    case 0xca: u = 4; break;
+    case 0xcb: u = 8; break;
+    case 0xcf: case 0xd3: u = 8; break;
+    case 0xc4: case 0xc5: case 0xc6:
+      if(!getBE(u, 1 << (b - 0xc4))) return false;
+      break;
+    case 0xd4: u = 2; break;
+    case 0xd5: u = 3; break;
+    case 0xd6: u = 5; break;
+    case 0xd7: u = 9; break;
+    case 0xd8: u = 17; break;
+    case 0xc7: case 0xc8: case 0xc9:
+      if(!getBE(u, 1 << (b - 0xc7))) return false;
+      u++;      // type byte
+      break;
+    default: return fail();
+  }
+  if(u > _len - _pos) {
+    return fail();
+  }
+  _pos += u;
+  return true;
+}
@@ -2,9 +2,7 @@
 #include <ArduinoJson.h>
 #include <ESP8266HTTPClient.h>
 #include <main.h>
-
-HTTPClient httpClient;
-WiFiClient wifiClient;
+#include <msgpack.h>
 
 #define EVENT_TYPE_INFO     "Info"
 #define EVENT_TYPE_WARN     "Warning"
@@ -17,8 +15,9 @@ struct NotifyMessage {
   char Type[MSG_TYPE_LEN];
   char Subject[MSG_SUBJECT_LEN];
   char Message[MSG_MESSAGE_LEN];
+  int Door;                   // -1 for the device
 } EventMessage;
-#define EVENT_MSG_JSON_SIZE (JSON_OBJECT_SIZE(3))
+#define EVENT_MSG_JSON_SIZE (JSON_OBJECT_SIZE(4))
 
 size_t SerializeMessageBody(const NotifyMessage& msgBody, char* json, size_t maxSize) {
     StaticJsonBuffer<EVENT_MSG_JSON_SIZE> jsonBuffer;
@@ -26,12 +25,16 @@ size_t SerializeMessageBody(const NotifyMessage& msgBody, char* json, size_t max
     jsonDoc["type"] = msgBody.Type;
     jsonDoc["subject"] = msgBody.Subject;
     jsonDoc["message"] = msgBody.Message;
+    if(msgBody.Door >= 0) {
+      jsonDoc["door"] = msgBody.Door;
+    }
     return jsonDoc.printTo(json, maxSize);
 }
 
-NotifyMessage& createEventMessage(int eventId, const char* msg = NULL, int msgLen = 0) {
+NotifyMessage& createEventMessage(int eventId, const char* msg = NULL, int msgLen = 0, int door = -1) {
 
   strcpy(EventMessage.Type, EVENT_TYPE_INFO);
+  EventMessage.Door = door;
 
   switch(eventId) {
     case IOT_EVENT_AUTO_CLOSING_DOOR:
@@ -68,6 +71,11 @@ NotifyMessage& createEventMessage(int eventId, const char* msg = NULL, int msgLe
       strcpy(EventMessage.Subject, "Door control is disabled");
       strcpy(EventMessage.Message, "Door would have closed by now, but control has been disabled.\n");
       break;
+    case IOT_EVENT_SLOW_DOOR:
+      strcpy(EventMessage.Type, EVENT_TYPE_WARN);
+      strcpy(EventMessage.Subject, "Garage door closing slowly");
+      strcpy(EventMessage.Message, "The garage door took much longer than usual to close. The opener may need a look.\n");
+      break;
 
     default:
       strcpy(EventMessage.Subject, "Unknown event");
@@ -76,6 +84,13 @@ NotifyMessage& createEventMessage(int eventId, const char* msg = NULL, int msgLe
       break;
   }
 
+#if DOOR_COUNT > 1
+  if(door >= 0) {
+    size_t len = strlen(EventMessage.Subject);
+    snprintf(EventMessage.Subject + len, MSG_SUBJECT_LEN - len, " (door %d)", door);
+  }
+#endif
+
   if(msgLen == -1) {
     msgLen = strlen(msg);
   }
@@ -85,61 +100,263 @@ NotifyMessage& createEventMessage(int eventId, const char* msg = NULL, int msgLe
   return EventMessage;
 }
 
-unsigned long lastNotifyTime = 0;
-int lastNotifiedEventId = IOT_EVENT_NONE;
-
 #define NOTIFY_URL          IOT_API_BASE_URL "/notify"
 #define JSON_BUFFER_SIZE    1024
 
 char jsonText[JSON_BUFFER_SIZE];
-char msgBuffer[MSG_MESSAGE_LEN];
 
-bool sendNotification(int eventId, const char* msg, int msgLen) {
+// Notifications are queued and sent from the main loop, retried with exponential backoff.
+// Events with the same id and door still waiting in the queue are coalesced into one message.
+// When the queue is full, the oldest of the least important events makes room, so a burst of
+// device events during an outage can't push out an unsent door failure.
+#define NOTIFY_QUEUE_LEN        6
+#define NOTIFY_DETAIL_LEN       240
+#define NOTIFY_SENDS_PER_PASS   2
+#define NOTIFY_RETRY_MIN_MS     (10UL * 1000)       // 10 seconds
+#define NOTIFY_RETRY_MAX_MS     (10UL * 60 * 1000)  // 10 minutes
+#define NOTIFY_EVENT_SLOTS      16
+
+struct QueuedNotification {
+  int EventId;
+  int Door;                   // -1 for the device
+  int Count;                  // how many times the event occurred
+  unsigned long FirstMs;
+  unsigned long LastMs;
+  int Attempts;
+  unsigned long NextTryMs;
+  char Detail[NOTIFY_DETAIL_LEN];
+};
+
+QueuedNotification notifyQueue[NOTIFY_QUEUE_LEN];
+int notifyQueueLen = 0;
+unsigned long notificationsDropped = 0;
+unsigned long lastNotifyTime[NOTIFY_EVENT_SLOTS][DOOR_COUNT]; // device events in the door 0 slot
+
+bool isDue(unsigned long now, unsigned long dueMs) {
+  return (long)(now - dueMs) >= 0;
+}
+
+void removeNotification(int ndx) {
+  notifyQueueLen--;
+  memmove(&notifyQueue[ndx], &notifyQueue[ndx + 1], (notifyQueueLen - ndx) * sizeof(QueuedNotification));
+}
+
+int notificationPriority(int eventId) {
+  switch(eventId) {
+    case IOT_EVENT_CLOSING_FAILURE:
+    case IOT_EVENT_SLOW_DOOR:
+    case IOT_EVENT_CONTROL_DISABLED:
+      return 2;
+    case IOT_EVENT_AUTO_CLOSING_DOOR:
+    case IOT_EVENT_CLOSED_DOOR:
+      return 1;
+  }
+  return 0;
+}
+
+unsigned long& lastNotifyTimeOf(int eventId, int door) {
+  return lastNotifyTime[eventId][door < 0 ? 0 : door];
+}
+
+bool sendNotification(int eventId, const char* msg, int msgLen, int door) {
 
   unsigned long now = millis();
-  if((eventId == lastNotifiedEventId) && (now - lastNotifyTime < AppConfig.MinNotifyPeriodMs)) {
-    return true;
+
+  QueuedNotification* qn = NULL;
+  for(int n = 0; n < notifyQueueLen; n++) {
+    if(notifyQueue[n].EventId == eventId && notifyQueue[n].Door == door) {
+      qn = &notifyQueue[n];
+      qn->Count++;
+      qn->LastMs = now;
+      break;
+    }
   }
-  lastNotifyTime = now;
-  lastNotifiedEventId = eventId;
 
-  if(NULL != msg) {
-    // make a copy of the msg, as it could be the log buffer, and log() will mess it up.
-    strncpy(msgBuffer, msg, MSG_MESSAGE_LEN);
-    msgBuffer[MSG_MESSAGE_LEN-1] = '\0';
+  if(NULL == qn) {
+    if(notifyQueueLen == NOTIFY_QUEUE_LEN) {
+      int victim = 0;
+      for(int n = 1; n < notifyQueueLen; n++) {
+        if(notificationPriority(notifyQueue[n].EventId) < notificationPriority(notifyQueue[victim].EventId)) {
+          victim = n;
+        }
+      }
+      notificationsDropped++;
+      if(notificationPriority(notifyQueue[victim].EventId) > notificationPriority(eventId)) {
+        return false; // everything queued matters more
+      }
+      removeNotification(victim);
+    }
+    qn = &notifyQueue[notifyQueueLen++];
+    qn->EventId = eventId;
+    qn->Door = door;
+    qn->Count = 1;
+    qn->FirstMs = qn->LastMs = now;
+    qn->Attempts = 0;
+    qn->NextTryMs = now;
+
+    // don't repeat the same event more often than configured
+    if(0 <= eventId && eventId < NOTIFY_EVENT_SLOTS && lastNotifyTimeOf(eventId, door) != 0
+       && now - lastNotifyTimeOf(eventId, door) < AppConfig.MinNotifyPeriodMs) {
+      qn->NextTryMs = lastNotifyTimeOf(eventId, door) + AppConfig.MinNotifyPeriodMs;
+    }
   }
-  else {
-    msgBuffer[0] = '\0';
+
+  // make a copy of the msg (the latest one is kept), as it could be the log buffer, and log() will mess it up.
+  if(NULL == msg) {
     msgLen = 0;
   }
+  else if(msgLen == -1) {
+    msgLen = strlen(msg);
+  }
+  if(msgLen > NOTIFY_DETAIL_LEN - 1) {
+    msgLen = NOTIFY_DETAIL_LEN - 1;
+  }
+  if(msgLen > 0) {
+    memcpy(qn->Detail, msg, msgLen);
+  }
+  qn->Detail[msgLen] = '\0';
+
+  return true;
+}
+
+// Compact notification: the event as its id, the server has the texts for it.
+// Map keys are small ints: 0 event id, 1 detail, 2 count, 3 first seen secs ago, 4 last seen secs ago,
+// 5 door (door events only).
+#define NOTIFY_KEY_EVENT    0
+#define NOTIFY_KEY_DETAIL   1
+#define NOTIFY_KEY_COUNT    2
+#define NOTIFY_KEY_FIRST    3
+#define NOTIFY_KEY_LAST     4
+#define NOTIFY_KEY_DOOR     5
 
-  if(!ensureWiFi()) {
-    log("Cannot notify: no wifi.");
+size_t SerializeMsgPackBody(const QueuedNotification& qn, uint8_t* buff, size_t maxSize) {
+  MsgPackWriter msg(buff, maxSize);
+  unsigned long now = millis();
+  bool repeated = qn.Count > 1;
+  msg.writeMap((repeated ? 5 : 2) + (qn.Door >= 0 ? 1 : 0));
+  msg.writeUint(NOTIFY_KEY_EVENT);
+  msg.writeInt(qn.EventId);
+  msg.writeUint(NOTIFY_KEY_DETAIL);
+  msg.writeStr(qn.Detail);
+  if(qn.Door >= 0) {
+    msg.writeUint(NOTIFY_KEY_DOOR);
+    msg.writeUint(qn.Door);
+  }
+  if(repeated) {
+    msg.writeUint(NOTIFY_KEY_COUNT);
+    msg.writeUint(qn.Count);
+    msg.writeUint(NOTIFY_KEY_FIRST);
+    msg.writeUint((now - qn.FirstMs) / 1000);
+    msg.writeUint(NOTIFY_KEY_LAST);
+    msg.writeUint((now - qn.LastMs) / 1000);
+  }
+  return msg.length();
+}
+
+bool postNotification(QueuedNotification& qn) {
+  if(WIRE_MSGPACK == IotWireFormat) {
+    size_t size = SerializeMsgPackBody(qn, (uint8_t*)jsonText, JSON_BUFFER_SIZE);
+#ifdef IOT_TRANSPORT_MQTT
+    return mqttPublishNow(MQTT_TOPIC_EVENT, (const uint8_t*)jsonText, size);
+#else
+    HTTPClient& http = iotHttpBegin(NOTIFY_URL, 10000);
+    http.addHeader("Content-Type", MSGPACK_CONTENT_TYPE);
+    int code = http.POST((const uint8_t*)jsonText, size);
+    iotHttpEnd(code, size);
+    if(code == 200) {
+      logd("Notification %d sent, %d bytes of msgpack.", qn.EventId, size);
+      return true;
+    }
+    log("Failed to send notification %d, http code %d", qn.EventId, code);
     return false;
+#endif
   }
 
-  NotifyMessage& msgToSend = createEventMessage(eventId, msgBuffer, msgLen);
+  NotifyMessage& msgToSend = createEventMessage(qn.EventId, qn.Detail, -1, qn.Door);
+  if(qn.Count > 1) {
+    char first[24], last[24];
+    unsigned long now = millis();
+    size_t len = strlen(msgToSend.Message);
+    snprintf(msgToSend.Message + len, MSG_MESSAGE_LEN - len, "\nOccurred %d times, first %s ago, last %s ago.",
+      qn.Count, formatMillis(first, now - qn.FirstMs), formatMillis(last, now - qn.LastMs));
+  }
   size_t jsonSize = SerializeMessageBody(msgToSend, jsonText, JSON_BUFFER_SIZE);
 
-  bool result = false;
+#ifdef IOT_TRANSPORT_MQTT
+  return mqttPublishNow(MQTT_TOPIC_EVENT, (const uint8_t*)jsonText, jsonSize);
+#else
 
-  httpClient.begin(wifiClient, NOTIFY_URL);
-  httpClient.setTimeout(10000);
-  int code = httpClient.POST((const uint8_t*)jsonText, jsonSize);
-  httpClient.end();
+  HTTPClient& http = iotHttpBegin(NOTIFY_URL, 10000);
+  int code = http.POST((const uint8_t*)jsonText, jsonSize);
+  iotHttpEnd(code, jsonSize);
 
   if(code == 200){
     logd("Notification sent.\n%s", jsonText);
-    result = true;
+    return true;
   }
-  else {
-    log("Failed to send notification, http code %d\n%s", code, jsonText);
+
+  log("Failed to send notification, http code %d\n%s", code, jsonText);
+  return false;
+#endif
+}
+
+void processNotifications() {
+  if(0 == notifyQueueLen || !wifiConnected()) {
+    return;
   }
 
-  return result;
+  unsigned long now = millis();
+  int sent = 0;
+  for(int n = 0; n < notifyQueueLen && sent < NOTIFY_SENDS_PER_PASS; ) {
+    QueuedNotification& qn = notifyQueue[n];
+    if(!isDue(now, qn.NextTryMs)) {
+      n++;
+      continue;
+    }
+
+    sent++;
+    if(postNotification(qn)) {
+      if(0 <= qn.EventId && qn.EventId < NOTIFY_EVENT_SLOTS) {
+        lastNotifyTimeOf(qn.EventId, qn.Door) = now;
+      }
+      removeNotification(n);
+      continue;
+    }
+
+    // back off: 10s, 20s, 40s ... up to 10 minutes
+    unsigned long backoffMs = NOTIFY_RETRY_MIN_MS << (qn.Attempts < 6 ? qn.Attempts : 6);
+    qn.Attempts++;
+    qn.NextTryMs = now + (backoffMs < NOTIFY_RETRY_MAX_MS ? backoffMs : NOTIFY_RETRY_MAX_MS);
+    n++;
+  }
 }
 
 #define LOG_URL    IOT_API_BASE_URL "/log?deviceid=" DEVICE_ID
+
+// Log lines are buffered and posted in batches from the main loop,
+// so logging never waits on the network.
+// When full, the oldest lines are dropped to make room.
+#define LOG_BATCH_SIZE      2048
+#define LOG_POST_TIMEOUT_MS 2000
+char logBatch[LOG_BATCH_SIZE];
+size_t logBatchLen = 0;
+int logBatchLines = 0;
+unsigned long logBatchStartMs = 0;    // when the oldest pending line was added
+unsigned long logLinesDropped = 0;    // total since reset
+unsigned long logLinesDroppedUnsent = 0;
+unsigned long lastLogFlushMs = 0;
+bool logFlushFailed = false;
+
+void dropOldestLogLine() {
+  char* eol = (char*) memchr(logBatch, '\n', logBatchLen);
+  size_t lineLen = (eol == NULL) ? logBatchLen : (eol - logBatch + 1);
+  memmove(logBatch, logBatch + lineLen, logBatchLen - lineLen);
+  logBatchLen -= lineLen;
+  logBatchLines--;
+  logLinesDropped++;
+  logLinesDroppedUnsent++;
+}
+
 void postLog(const char* logMsg) {
 
   // NOTE: do not call any functions that call log() themselves!
@@ -147,22 +364,105 @@ void postLog(const char* logMsg) {
     return;
   }
 
+  size_t msgLen = strlen(logMsg);
+  if(msgLen > LOG_BATCH_SIZE - 1) {
+    msgLen = LOG_BATCH_SIZE - 1;
+  }
+  while(logBatchLen + msgLen + 1 > LOG_BATCH_SIZE) {
+    dropOldestLogLine();
+  }
+
+  if(0 == logBatchLines) {
+    logBatchStartMs = millis();
+  }
+  memcpy(logBatch + logBatchLen, logMsg, msgLen);
+  logBatchLen += msgLen;
+  logBatch[logBatchLen++] = '\n';
+  logBatchLines++;
+}
+
+void flushLog() {
+
+  // NOTE: do not call any functions that call log() themselves!
+  if(!AppConfig.PostLog) {
+    logBatchLen = 0;
+    logBatchLines = 0;
+    return;
+  }
+
+  unsigned long now = millis();
+  if(0 == logBatchLines ||
+    (logBatchLines < AppConfig.LogFlushLines && now - logBatchStartMs < AppConfig.LogFlushMs)) {
+    return;
+  }
+  if(logFlushFailed && now - lastLogFlushMs < AppConfig.LogFlushMs) {
+    return; // back off after a failed post
+  }
+
+#ifdef IOT_TRANSPORT_MQTT
+  // no log() calls from here either
+  // in parts that fit a packet, split after a line
+  for(size_t start = 0; start < logBatchLen; ) {
+    size_t len = logBatchLen - start;
+    if(len > MQTT_MAX_PAYLOAD) {
+      len = MQTT_MAX_PAYLOAD;
+      while(len > 0 && logBatch[start + len - 1] != '\n') {
+        len--;
+      }
+      if(0 == len) {
+        len = MQTT_MAX_PAYLOAD; // one line longer than a part
+      }
+    }
+    mqttPublish(MQTT_TOPIC_LOG, (const uint8_t*)logBatch + start, len);
+    start += len;
+  }
+  logBatchLen = 0;
+  logBatchLines = 0;
+#else
+
   if(!wifiConnected()) {
     // can't use log() calls here
-    Serial.println("Cannot post log: no wifi.");
     return;
   }
+  lastLogFlushMs = now;
+
+  char droppedLine[48];
+  int droppedLen = 0;
+  if(logLinesDroppedUnsent > 0) {
+    droppedLen = snprintf(droppedLine, sizeof(droppedLine), "%lu log lines dropped.\n", logLinesDroppedUnsent);
+  }
 
-  httpClient.begin(wifiClient, LOG_URL);
-  httpClient.setTimeout(500);
-  int code = httpClient.POST((const uint8_t*)logMsg, strlen(logMsg));
-  httpClient.end();
-  if(code != 200){
-    Serial.printf("Posting log message failed: %s\n", jsonText);
+  HTTPClient& http = iotHttpBegin(LOG_URL, LOG_POST_TIMEOUT_MS);
+  int code;
+  size_t sent = logBatchLen;
+  bool droppedSent = false; // without room for the line, the count waits for the next post
+  if(droppedLen > 0 && logBatchLen + droppedLen <= LOG_BATCH_SIZE) {
+    // prepend the drop count in place
+    memmove(logBatch + droppedLen, logBatch, logBatchLen);
+    memcpy(logBatch, droppedLine, droppedLen);
+    code = http.POST((const uint8_t*)logBatch, logBatchLen + droppedLen);
+    sent += droppedLen;
+    droppedSent = true;
+    memmove(logBatch, logBatch + droppedLen, logBatchLen);
   }
   else {
-    if(AppConfig.DebugLog) {
-      Serial.printf("Posted message to %s\n", LOG_URL);
-    }
+    code = http.POST((const uint8_t*)logBatch, logBatchLen);
+  }
+  iotHttpEnd(code, sent);
+
+  logFlushFailed = (code != 200);
+  if(logFlushFailed){
+    Serial.printf("Posting %d log lines failed, http code %d\n", logBatchLines, code);
+    return;
+  }
+
+  if(AppConfig.DebugLog) {
+    Serial.printf("Posted %d log lines to %s\n", logBatchLines, LOG_URL);
+  }
+  if(droppedSent) {
+    logLinesDroppedUnsent = 0;
   }
+  logBatchLen = 0;
+  logBatchLines = 0;
+#endif
 }
@@ -0,0 +1,104 @@
+#include <Arduino.h>
+#include <Ticker.h>
+#include <pattern.h>
+#include <pins.h>
+
+struct PatternChannel {
+  uint8_t Pin;
+  bool Inverted; // LEDs are pulled up, inverted logic
+  Ticker Timer;
+
+  const PatternStep* Steps = NULL;
+  int StepCount = 0;
+  bool Loop = false;
+  PatternDoneCallback OnDone = NULL;
+
+  int StepNdx = 0;
+  unsigned int Cycle = 0;
+  bool On = false;
+  volatile bool Running = false;
+};
+
+PatternChannel patternChannels[PATTERN_CHANNEL_COUNT] = {
+  { BUZZER_PIN, false },
+  { LED_RED_PIN, true },
+  { LED_BLUE_PIN, true }
+};
+
+void setPatternOutput(PatternChannel& pc, bool on) {
+  pc.On = on;
+  digitalWrite(pc.Pin, (on != pc.Inverted) ? 1 : 0);
+}
+
+void patternTick(int channel);
+
+void schedulePatternTick(PatternChannel& pc, int channel, unsigned int ms) {
+  pc.Timer.once_ms(ms > 0 ? ms : 1, patternTick, channel);
+}
+
+// Runs from the timer context on every on/off edge.
+void patternTick(int channel) {
+  PatternChannel& pc = patternChannels[channel];
+  if(!pc.Running) {
+    return;
+  }
+
+  const PatternStep* step = &pc.Steps[pc.StepNdx];
+  if(pc.On) {
+    setPatternOutput(pc, false);
+    if(step->OffMs > 0) {
+      schedulePatternTick(pc, channel, step->OffMs);
+      return;
+    }
+  }
+
+  // the off part of the cycle is done, move on to the next cycle
+  if(++pc.Cycle >= step->Repeat) {
+    pc.Cycle = 0;
+    if(++pc.StepNdx >= pc.StepCount) {
+      if(!pc.Loop) {
+        pc.Running = false;
+        if(pc.OnDone != NULL) {
+          pc.OnDone(channel);
+        }
+        return;
+      }
+      pc.StepNdx = 0;
+    }
+    step = &pc.Steps[pc.StepNdx];
+  }
+
+  setPatternOutput(pc, true);
+  schedulePatternTick(pc, channel, step->OnMs);
+}
+
+void startPattern(int channel, const PatternStep* steps, int stepCount, bool loop, PatternDoneCallback onDone) {
+  PatternChannel& pc = patternChannels[channel];
+  pc.Timer.detach();
+
+  pc.Steps = steps;
+  pc.StepCount = stepCount;
+  pc.Loop = loop;
+  pc.OnDone = onDone;
+  pc.StepNdx = 0;
+  pc.Cycle = 0;
+  pc.Running = stepCount > 0;
+  if(!pc.Running) {
+    setPatternOutput(pc, false);
+    return;
+  }
+
+  setPatternOutput(pc, true);
+  schedulePatternTick(pc, channel, steps[0].OnMs);
+}
+
+void stopPattern(int channel) {
+  PatternChannel& pc = patternChannels[channel];
+  pc.Timer.detach();
+  pc.Running = false;
+  setPatternOutput(pc, false);
+}
+
+bool patternRunning(int channel) {
+  return patternChannels[channel].Running;
+}
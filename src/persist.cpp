@@ -0,0 +1,272 @@
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <main.h>
+
+// The clock and the door timeline are kept over resets, so the monitor is working again
+// right after setup() instead of waiting for the server.
+// RTC user memory survives soft resets and gets a checkpoint every few seconds, it doesn't wear.
+// Flash (LittleFS) survives power cuts. It only gets the door timeline, travel profiles and calibrated
+// sensor ranges when they change, the time zone and drift at most once an hour, and the config when
+// a new one is applied.
+
+#define PERSIST_RTC_OFFSET      16      // in 4 byte blocks, after the WiFi cache
+#define PERSIST_RTC_MS          (10UL * 1000)
+#define PERSIST_BOOT_MS         2000    // from the reset to setup()
+#define PERSIST_FLASH_MIN_MS    (60UL * 60 * 1000)
+#define PERSIST_DRIFT_STEP_PPM  1.0f    // smaller drift changes are not worth a flash write
+#define PERSIST_STATE_FILE      "/state.bin"
+#define PERSIST_STATE_TMP       "/state.tmp"
+#define PERSIST_VERSION         4
+
+struct RtcState {
+  uint32_t Check;               // hash of the rest
+  uint32_t Version;
+  TimeCheckpoint Time;
+  uint32_t DoorOpenForMs[DOOR_COUNT];       // 0 when closed
+  uint32_t SinceCloseAttemptMs[DOOR_COUNT]; // 0 without a failed attempt
+};
+
+struct FlashState {
+  uint32_t Check;               // hash of the rest
+  uint32_t Version;
+  TimeCheckpoint Time;          // without utc, the clock doesn't survive a power cut
+  uint32_t DoorOpenedUtc[DOOR_COUNT];       // seconds, 0 when closed or not known
+  uint32_t LastCloseAttemptUtc[DOOR_COUNT];
+  TravelProfile Travel[DOOR_COUNT];
+  int32_t SensorRanges[DOOR_COUNT][DOOR_STATE_COUNT][2];
+};
+
+bool persistReady = false;
+RtcState rtcState;
+FlashState flashState;          // as last written
+unsigned long lastRtcSaveMs = 0;
+unsigned long lastFlashSaveMs = 0;
+bool flashSaved = false;
+unsigned long savedDoorOpenedSinceMs[DOOR_COUNT];
+unsigned long savedCloseAttemptMs[DOOR_COUNT];
+bool savedDoorTimeKnown = false;
+bool doorTimelinePending[DOOR_COUNT]; // read from flash, waiting for the clock to be applied
+
+template<typename T> uint32_t persistCheck(const T& record) {
+  return hashText((const char*) &record + sizeof(record.Check), sizeof(record) - sizeof(record.Check));
+}
+
+template<typename T> bool persistValid(const T& record) {
+  return record.Version == PERSIST_VERSION && record.Check == persistCheck(record);
+}
+
+size_t readPersistedFile(const char* path, char* buff, size_t size) {
+  if(!persistReady) {
+    return 0;
+  }
+  File file = LittleFS.open(path, "r");
+  if(!file) {
+    return 0;
+  }
+  size_t len = file.size() <= size ? file.read((uint8_t*) buff, size) : 0;
+  file.close();
+  return len;
+}
+
+// Written aside and renamed, so a reset halfway leaves the old file.
+bool writePersistedFile(const char* path, const char* tmpPath, const void* data, size_t len) {
+  if(!persistReady) {
+    return false;
+  }
+  File file = LittleFS.open(tmpPath, "w");
+  if(!file) {
+    log("Cannot write %s.", tmpPath);
+    return false;
+  }
+  size_t written = file.write((const uint8_t*) data, len);
+  file.close();
+  if(written != len) {
+    log("Cannot write %s: %d of %d bytes written.", tmpPath, written, len);
+    LittleFS.remove(tmpPath);
+    return false;
+  }
+  LittleFS.remove(path);
+  return LittleFS.rename(tmpPath, path);
+}
+
+// How long ago a time, elapsedMs before the reset, was. The time since boot is added,
+// the reset itself isn't: the door is never taken to be open for longer than it was.
+unsigned long restoredSinceMs(uint32_t elapsedMs) {
+  unsigned long sinceMs = 0UL - elapsedMs;
+  return 0 == sinceMs ? 1 : sinceMs; // 0 is the 'not set' flag
+}
+
+unsigned long utcToSinceMs(uint32_t utcSec) {
+  uint32_t nowSec = utcNowMs() / 1000;
+  return nowSec > utcSec ? millis() - (nowSec - utcSec) * 1000UL : millis();
+}
+
+uint32_t sinceMsToUtc(unsigned long sinceMs) {
+  if(0 == sinceMs || TIME_CONFIDENCE_NONE == timeConfidence()) {
+    return 0;
+  }
+  return (utcNowMs() - (millis() - sinceMs)) / 1000;
+}
+
+// Soft resets: the clock and the door timeline go on from the last checkpoint.
+bool restoreFromRtc() {
+  if(!ESP.rtcUserMemoryRead(PERSIST_RTC_OFFSET, (uint32_t*) &rtcState, sizeof(rtcState)) || !persistValid(rtcState)) {
+    return false;
+  }
+  restoreTime(rtcState.Time, PERSIST_RTC_MS + PERSIST_BOOT_MS);
+  for(int door = 0; door < DOOR_COUNT; door++) {
+    if(rtcState.DoorOpenForMs[door] != 0) {
+      doorOpenedSinceMs[door] = restoredSinceMs(rtcState.DoorOpenForMs[door]);
+    }
+    if(rtcState.SinceCloseAttemptMs[door] != 0) {
+      lastCloseAttemptMs[door] = restoredSinceMs(rtcState.SinceCloseAttemptMs[door]);
+    }
+    log("State restored after reset. Door %d open for %lu ms, last close attempt %lu ms ago.", door,
+      (unsigned long) rtcState.DoorOpenForMs[door], (unsigned long) rtcState.SinceCloseAttemptMs[door]);
+  }
+  return true;
+}
+
+// Reads the record as last written; it is only applied when there was nothing in RTC memory.
+void restoreFromFlash(bool apply) {
+  if(sizeof(flashState) != readPersistedFile(PERSIST_STATE_FILE, (char*) &flashState, sizeof(flashState))
+      || !persistValid(flashState)) {
+    memset(&flashState, 0, sizeof(flashState));
+    return;
+  }
+  flashSaved = true;
+  memcpy(DoorTravel, flashState.Travel, sizeof(DoorTravel)); // learned, whatever the reset
+  memcpy(SensorCalibration, flashState.SensorRanges, sizeof(SensorCalibration));
+  applySensorCalibration();
+  if(!apply) {
+    return;
+  }
+  restoreTime(flashState.Time, 0);
+  for(int door = 0; door < DOOR_COUNT; door++) {
+    doorTimelinePending[door] = flashState.DoorOpenedUtc[door] != 0;
+    log("State restored from flash. Door %d open since %lu, last close attempt at %lu (utc).", door,
+      (unsigned long) flashState.DoorOpenedUtc[door], (unsigned long) flashState.LastCloseAttemptUtc[door]);
+  }
+}
+
+// After a power cut the door timeline waits for the clock and a settled sensor. It is only
+// taken if the door is (still) open, and only makes the door open for longer than seen since boot.
+bool applyDoorTimeline(int door) {
+  if(TIME_CONFIDENCE_NONE == timeConfidence()) {
+    return false;
+  }
+  int doorState = getDoorState(door);
+  if(DOOR_UNSTABLE == doorState || DOOR_UNKNOWN == doorState) {
+    return false;
+  }
+  if(DOOR_CLOSED == doorState) {
+    return true;
+  }
+
+  unsigned long openedSinceMs = utcToSinceMs(flashState.DoorOpenedUtc[door]);
+  if(0 == doorOpenedSinceMs[door] || millis() - openedSinceMs > millis() - doorOpenedSinceMs[door]) {
+    doorOpenedSinceMs[door] = 0 == openedSinceMs ? 1 : openedSinceMs;
+  }
+  if(0 == lastCloseAttemptMs[door] && flashState.LastCloseAttemptUtc[door] != 0) {
+    unsigned long attemptMs = utcToSinceMs(flashState.LastCloseAttemptUtc[door]);
+    lastCloseAttemptMs[door] = 0 == attemptMs ? 1 : attemptMs;
+  }
+  char buff[24];
+  log("Door %d open for %s, as of before the power cut.", door, formatMillis(buff, millis() - doorOpenedSinceMs[door]));
+  return true;
+}
+
+void saveRtcState() {
+  memset(&rtcState, 0, sizeof(rtcState));
+  rtcState.Version = PERSIST_VERSION;
+  checkpointTime(rtcState.Time);
+  for(int door = 0; door < DOOR_COUNT; door++) {
+    rtcState.DoorOpenForMs[door] = 0 == doorOpenedSinceMs[door] ? 0 : max(1UL, millis() - doorOpenedSinceMs[door]);
+    rtcState.SinceCloseAttemptMs[door] = 0 == lastCloseAttemptMs[door] ? 0 : max(1UL, millis() - lastCloseAttemptMs[door]);
+  }
+  rtcState.Check = persistCheck(rtcState);
+  ESP.rtcUserMemoryWrite(PERSIST_RTC_OFFSET, (uint32_t*) &rtcState, sizeof(rtcState));
+}
+
+bool clockStateChanged(const TimeCheckpoint& cp) {
+  const TimeCheckpoint& saved = flashState.Time;
+  return cp.TzOffsetKnown != saved.TzOffsetKnown || cp.TzOffsetSec != saved.TzOffsetSec
+    || cp.DriftKnown != saved.DriftKnown || fabsf(cp.DriftPpm - saved.DriftPpm) >= PERSIST_DRIFT_STEP_PPM;
+}
+
+void saveFlashState() {
+  bool timeKnown = TIME_CONFIDENCE_NONE != timeConfidence();
+  bool doorChanged = !flashSaved || (timeKnown && !savedDoorTimeKnown)
+    || 0 != memcmp(doorOpenedSinceMs, savedDoorOpenedSinceMs, sizeof(savedDoorOpenedSinceMs))
+    || 0 != memcmp(lastCloseAttemptMs, savedCloseAttemptMs, sizeof(savedCloseAttemptMs))
+    || 0 != memcmp(DoorTravel, flashState.Travel, sizeof(DoorTravel))
+    || 0 != memcmp(SensorCalibration, flashState.SensorRanges, sizeof(SensorCalibration));
+
+  TimeCheckpoint cp;
+  memset(&cp, 0, sizeof(cp)); // padding included, the record is hashed and compared
+  checkpointTime(cp);
+  cp.UtcMs = 0;
+  cp.ErrorMs = 0;
+  bool clockChanged = clockStateChanged(cp) && (!flashSaved || millis() - lastFlashSaveMs >= PERSIST_FLASH_MIN_MS);
+  if(!doorChanged && !clockChanged) {
+    return;
+  }
+
+  FlashState state;
+  memset(&state, 0, sizeof(state));
+  state.Version = PERSIST_VERSION;
+  state.Time = clockChanged || !flashSaved ? cp : flashState.Time;
+  for(int door = 0; door < DOOR_COUNT; door++) {
+    state.DoorOpenedUtc[door] = sinceMsToUtc(doorOpenedSinceMs[door]);
+    state.LastCloseAttemptUtc[door] = sinceMsToUtc(lastCloseAttemptMs[door]);
+  }
+  memcpy(state.Travel, DoorTravel, sizeof(state.Travel));
+  memcpy(state.SensorRanges, SensorCalibration, sizeof(state.SensorRanges));
+  state.Check = persistCheck(state);
+
+  memcpy(savedDoorOpenedSinceMs, doorOpenedSinceMs, sizeof(savedDoorOpenedSinceMs));
+  memcpy(savedCloseAttemptMs, lastCloseAttemptMs, sizeof(savedCloseAttemptMs));
+  savedDoorTimeKnown = timeKnown;
+  if(flashSaved && 0 == memcmp(&state, &flashState, sizeof(state))) {
+    return;
+  }
+  if(writePersistedFile(PERSIST_STATE_FILE, PERSIST_STATE_TMP, &state, sizeof(state))) {
+    flashState = state;
+    flashSaved = true;
+    lastFlashSaveMs = millis();
+    logd("State saved to flash.");
+  }
+}
+
+// Called early in setup(): mounts the file system and brings back the config and the state.
+void restorePersisted() {
+  persistReady = LittleFS.begin();
+  if(!persistReady) {
+    log("Formatting the file system.");
+    persistReady = LittleFS.format() && LittleFS.begin();
+  }
+  if(!persistReady) {
+    log("No file system, nothing is kept over a power cut.");
+  }
+
+  restoreConfig();
+  restoreFromFlash(!restoreFromRtc());
+}
+
+// Called from loop().
+void servicePersist() {
+  bool timelinePending = false;
+  for(int door = 0; door < DOOR_COUNT; door++) {
+    if(doorTimelinePending[door] && applyDoorTimeline(door)) {
+      doorTimelinePending[door] = false;
+    }
+    timelinePending |= doorTimelinePending[door];
+  }
+  if(millis() - lastRtcSaveMs >= PERSIST_RTC_MS) {
+    lastRtcSaveMs = millis();
+    saveRtcState();
+  }
+  if(!timelinePending) {
+    saveFlashState(); // the flash record is kept until it has been applied
+  }
+}
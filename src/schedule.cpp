@@ -0,0 +1,234 @@
+#include <Arduino.h>
+#include <TimeLib.h>
+#include <main.h>
+
+// Keep-closed schedule, compiled from the config into one bit per minute of the week,
+// so the check is a single bit test.
+//
+// KeepClosedSchedule is a list of windows separated by ',' or ';': [days] HHMM-HHMM
+// Days are Sun Mon Tue Wed Thu Fri Sat, ranges like Mon-Fri, joined with '+', e.g. Sat+Sun.
+// Without days the window is every day. Both ends are included and a window may run past
+// midnight into the next day. An empty schedule is KeepClosedFromTo every day.
+// On KeepClosedHolidays dates the Sunday windows are used for that day.
+// Each door has its own schedule; doors after the first without one follow door 0.
+
+#define MINUTES_PER_DAY     (24 * 60)
+#define MINUTES_PER_WEEK    (7 * MINUTES_PER_DAY)
+#define SCHEDULE_HOLIDAYS   16
+#define HOLIDAY_WEEKDAY     0 // Sunday
+
+uint8_t keepClosedMinutes[DOOR_COUNT][MINUTES_PER_WEEK / 8]; // bit m: minute m of the week, from Sunday 00:00
+bool scheduleCompiled = false;
+
+uint32_t holidays[SCHEDULE_HOLIDAYS]; // MMDD, or YYYYMMDD for one year only
+int holidayCount = 0;
+long holidayCheckedDay = -1;          // days since 1970 of the cached answer
+bool holidayToday = false;
+
+const char* weekdayNames[] = { "sun", "mon", "tue", "wed", "thu", "fri", "sat" };
+
+inline bool minuteBit(const uint8_t* minutes, int m) {
+  return minutes[m >> 3] & (1 << (m & 7));
+}
+
+void setMinuteBits(uint8_t* minutes, int day, int from, int to) {
+  int start = day * MINUTES_PER_DAY + from;
+  int end = day * MINUTES_PER_DAY + to + (to < from ? MINUTES_PER_DAY : 0);
+  for(int m = start; m <= end; m++) {
+    int w = m % MINUTES_PER_WEEK;
+    minutes[w >> 3] |= 1 << (w & 7);
+  }
+}
+
+int hhmmToMinutes(int hhmm) {
+  return hhmm / 100 * 60 + min(hhmm % 100, 59);
+}
+
+const char* skipBlanks(const char* p) {
+  while(*p == ' ' || *p == '\t') {
+    p++;
+  }
+  return p;
+}
+
+// Three letter day name, case insensitive, -1 if it isn't one.
+int parseWeekday(const char*& p) {
+  for(int d = 0; d < 7; d++) {
+    if(0 == strncasecmp(p, weekdayNames[d], 3)) {
+      p += 3;
+      return d;
+    }
+  }
+  return -1;
+}
+
+// Days as a bit mask, 0x7f when there are none.
+bool parseDays(const char*& p, uint8_t& days) {
+  days = 0;
+  p = skipBlanks(p);
+  if(isdigit(*p)) {
+    days = 0x7f;
+    return true;
+  }
+  do {
+    if(*p == '+') {
+      p++;
+    }
+    int from = parseWeekday(p);
+    int to = from;
+    if(*p == '-') {
+      p++;
+      to = parseWeekday(p);
+    }
+    if(from < 0 || to < 0) {
+      return false;
+    }
+    for(int d = from; ; d = (d + 1) % 7) {
+      days |= 1 << d;
+      if(d == to) {
+        break;
+      }
+    }
+  } while(*p == '+');
+  return true;
+}
+
+bool parseWindow(const char*& p, uint8_t& days, int& from, int& to) {
+  if(!parseDays(p, days)) {
+    return false;
+  }
+  char* end;
+  p = skipBlanks(p);
+  long hhmmFrom = strtol(p, &end, 10);
+  if(end == p || *end != '-') {
+    return false;
+  }
+  p = end + 1;
+  long hhmmTo = strtol(p, &end, 10);
+  if(end == p || hhmmFrom < 0 || hhmmFrom > 2359 || hhmmTo < 0 || hhmmTo > 2359) {
+    return false;
+  }
+  p = skipBlanks(end);
+  from = hhmmToMinutes(hhmmFrom);
+  to = hhmmToMinutes(hhmmTo);
+  return *p == '\0' || *p == ',' || *p == ';';
+}
+
+void compileWindows(uint8_t* minutes, const char* text) {
+  const char* p = text;
+  while(*skipBlanks(p) != '\0') {
+    const char* window = p;
+    uint8_t days;
+    int from, to;
+    if(parseWindow(p, days, from, to)) {
+      for(int d = 0; d < 7; d++) {
+        if(days & (1 << d)) {
+          setMinuteBits(minutes, d, from, to);
+        }
+      }
+    }
+    else {
+      const char* logmsg = log("Bad keep closed window at: %.20s", window);
+      sendNotification(IOT_EVENT_CONFIG_ERROR, logmsg, -1);
+    }
+    while(*p != '\0' && *p != ',' && *p != ';') {
+      p++;
+    }
+    if(*p != '\0') {
+      p++;
+    }
+  }
+}
+
+void compileHolidays(const char* text) {
+  holidayCount = 0;
+  holidayCheckedDay = -1;
+  for(const char* p = text; *p != '\0'; ) {
+    char* end;
+    unsigned long date = strtoul(p, &end, 10);
+    if(end == p) {
+      p++; // separators
+      continue;
+    }
+    if(holidayCount < SCHEDULE_HOLIDAYS && date >= 101) {
+      holidays[holidayCount++] = date;
+    }
+    p = end;
+  }
+}
+
+// Called whenever a config has been applied.
+void compileSchedule() {
+  memset(keepClosedMinutes, 0, sizeof(keepClosedMinutes));
+  for(int door = 0; door < DOOR_COUNT; door++) {
+    uint8_t* minutes = keepClosedMinutes[door];
+    const char* text = AppConfig.Doors[door].KeepClosedSchedule;
+    if(*skipBlanks(text) != '\0') {
+      compileWindows(minutes, text);
+    }
+    else if(door > 0) {
+      memcpy(minutes, keepClosedMinutes[0], sizeof(keepClosedMinutes[0]));
+    }
+    else {
+      int from = hhmmToMinutes(AppConfig.KeepClosedFromTo[0]);
+      int to = hhmmToMinutes(AppConfig.KeepClosedFromTo[1]);
+      for(int d = 0; d < 7; d++) {
+        setMinuteBits(minutes, d, from, to);
+      }
+    }
+  }
+  compileHolidays(AppConfig.KeepClosedHolidays);
+  scheduleCompiled = true;
+}
+
+bool isHoliday(time_t t) {
+  long epochDay = t / 86400L;
+  if(epochDay != holidayCheckedDay) {
+    uint32_t mmdd = month(t) * 100 + day(t);
+    uint32_t yyyymmdd = year(t) * 10000UL + mmdd;
+    holidayToday = false;
+    for(int n = 0; n < holidayCount && !holidayToday; n++) {
+      holidayToday = holidays[n] == mmdd || holidays[n] == yyyymmdd;
+    }
+    holidayCheckedDay = epochDay;
+  }
+  return holidayToday;
+}
+
+int minuteOfWeek(time_t t) {
+  int wday = isHoliday(t) ? HOLIDAY_WEEKDAY : weekday(t) - 1;
+  return wday * MINUTES_PER_DAY + hour(t) * 60 + minute(t);
+}
+
+// t is local time.
+bool isKeepClosedTime(int door, time_t t) {
+  if(!scheduleCompiled) {
+    compileSchedule();
+  }
+  return minuteBit(keepClosedMinutes[door], minuteOfWeek(t));
+}
+
+// Minutes until isKeepClosedTime() changes, counted from the start of the current minute,
+// -1 if it never does.
+// Whole bytes that match the current state are skipped; holidays ahead are not looked at.
+long minutesToScheduleChange(int door, time_t t) {
+  if(!scheduleCompiled) {
+    compileSchedule();
+  }
+  const uint8_t* minutes = keepClosedMinutes[door];
+  int start = minuteOfWeek(t);
+  bool state = minuteBit(minutes, start);
+  uint8_t same = state ? 0xff : 0x00;
+  for(int n = 1; n < MINUTES_PER_WEEK; ) {
+    int m = (start + n) % MINUTES_PER_WEEK;
+    if((m & 7) == 0 && n + 8 <= MINUTES_PER_WEEK && minutes[m >> 3] == same) {
+      n += 8;
+      continue;
+    }
+    if(minuteBit(minutes, m) != state) {
+      return n;
+    }
+    n++;
+  }
+  return -1;
+}
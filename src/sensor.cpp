@@ -0,0 +1,373 @@
+#include <Arduino.h>
+#include <Ticker.h>
+#include <main.h>
+#include <pins.h>
+
+// The position sensors are sampled in the background, each every DebounceReadPauseMs.
+// Each sample goes into a ring buffer; the median of the last few samples is classified
+// with some hysteresis around the current state, and a new state becomes stable
+// once it is seen DebounceReadCount samples in a row.
+// With two doors the ticks alternate between them: the analog switch is flipped right after
+// a read, so it has settled by the next tick, and each door keeps its own sample rate.
+
+#define SENSOR_RING_LEN       16
+#define SENSOR_MEDIAN_LEN     5
+#define SENSOR_HYSTERESIS     16  // adc counts the current state's range is widened by
+#define SENSOR_EMA_SHIFT      2   // ema weight of 1/4
+
+// Histogram of all samples, used for the daily report and to calibrate the state ranges.
+// It is halved on every report, so older readings fade out.
+#define SENSOR_HIST_BUCKETS   64
+#define SENSOR_HIST_SHIFT     4   // 1024 / 64 adc counts per bucket
+#define SENSOR_CALIBRATION_MIN_SAMPLES  (60UL * 60 * 10) // about an hour of samples
+#define SENSOR_CALIBRATION_MIN_BUCKET   20  // less than that in a bucket is noise
+#define SENSOR_CALIBRATION_MARGIN       16  // adc counts added around a found cluster
+#define SENSOR_CALIBRATION_MAX_GAP      2   // empty buckets allowed inside a cluster
+#define SENSOR_CALIBRATION_GUARD        8   // adc counts kept free on each side of the split between ranges
+
+// With LogRawSensor every sample is kept here by the ticker and logged from loop(),
+// a line per door of "millis,value" pairs once enough have gathered.
+#define RAW_SAMPLE_RING       64
+#define RAW_SAMPLE_LINE       24  // samples waiting before they are logged
+
+struct RawSample {
+  uint32_t Ms;
+  uint16_t Value;
+  uint8_t Door;
+};
+
+RawSample rawSamples[RAW_SAMPLE_RING];
+int rawSampleHead = 0;    // where the ticker puts the next one
+int rawSampleTail = 0;    // the oldest not logged
+unsigned long rawSamplesDropped = 0;
+
+struct DoorSensor {
+  int Ring[SENSOR_RING_LEN];
+  int RingHead = 0;       // where the next sample goes
+  unsigned long SampleCount = 0;
+  int Median = 0;
+  int Ema = 0;            // scaled by 1 << SENSOR_EMA_SHIFT
+
+  int StableState = DOOR_UNKNOWN;
+  int CandidateState = DOOR_UNKNOWN;
+  int CandidateCount = 0;
+
+  uint32_t Histogram[SENSOR_HIST_BUCKETS];
+  uint32_t HistogramTotal = 0;
+  unsigned long OutOfRangeCount = 0;
+};
+
+DoorSensor sensors[DOOR_COUNT];
+// Ranges applied by AutoCalibrateSensor, all 0 while there are none. Kept in flash, and put back
+// over the configured ranges after each config, so neither a reset nor a server config loses them.
+int SensorCalibration[DOOR_COUNT][DOOR_STATE_COUNT][2];
+int sampledDoor = 0;      // the door the analog switch is set to
+volatile uint8_t sensorActivity = 0; // bit per door, readings changed class or a new state settled
+
+Ticker sensorTicker;
+int sensorSamplePeriodMs = 0;
+
+int classifySensorValue(const DoorSensor& sensor, const int ranges[DOOR_STATE_COUNT][2], int value) {
+  if(sensor.StableState >= 0) {
+    const int* range = ranges[sensor.StableState];
+    if(range[0] - SENSOR_HYSTERESIS <= value && value <= range[1] + SENSOR_HYSTERESIS) {
+      return sensor.StableState;
+    }
+  }
+  for(int ndx = 0; ndx < DOOR_STATE_COUNT; ndx++) {
+    if(ranges[ndx][0] <= value && value <= ranges[ndx][1]) {
+      return ndx;
+    }
+  }
+  return DOOR_UNKNOWN;
+}
+
+int medianOfLastSamples(const DoorSensor& sensor) {
+  int count = sensor.SampleCount < SENSOR_MEDIAN_LEN ? sensor.SampleCount : SENSOR_MEDIAN_LEN;
+  int sorted[SENSOR_MEDIAN_LEN];
+  for(int n = 0; n < count; n++) {
+    int v = sensor.Ring[(sensor.RingHead - 1 - n + SENSOR_RING_LEN) % SENSOR_RING_LEN];
+    int k = n;
+    for(; k > 0 && sorted[k - 1] > v; k--) {
+      sorted[k] = sorted[k - 1];
+    }
+    sorted[k] = v;
+  }
+  return sorted[count / 2];
+}
+
+// Runs from the timer context.
+void sampleSensor() {
+  int door = sampledDoor;
+  int rawVal = analogRead(POSITION_PIN);
+#if DOOR_COUNT > 1
+  sampledDoor = (sampledDoor + 1) % DOOR_COUNT;
+  digitalWrite(SENSOR_SELECT_PIN, sampledDoor);
+#endif
+
+  if(AppConfig.LogRawSensor) {
+    int next = (rawSampleHead + 1) % RAW_SAMPLE_RING;
+    if(next == rawSampleTail) {
+      rawSamplesDropped++;
+    }
+    else {
+      rawSamples[rawSampleHead] = { (uint32_t) millis(), (uint16_t) rawVal, (uint8_t) door };
+      rawSampleHead = next;
+    }
+  }
+
+  DoorSensor& sensor = sensors[door];
+  sensor.Ring[sensor.RingHead] = rawVal;
+  sensor.RingHead = (sensor.RingHead + 1) % SENSOR_RING_LEN;
+  sensor.SampleCount++;
+
+  int bucket = rawVal >> SENSOR_HIST_SHIFT;
+  sensor.Histogram[bucket < SENSOR_HIST_BUCKETS ? bucket : SENSOR_HIST_BUCKETS - 1]++;
+  sensor.HistogramTotal++;
+
+  sensor.Median = medianOfLastSamples(sensor);
+  if(sensor.SampleCount == 1) {
+    sensor.Ema = sensor.Median << SENSOR_EMA_SHIFT;
+  }
+  else {
+    sensor.Ema += sensor.Median - (sensor.Ema >> SENSOR_EMA_SHIFT);
+  }
+
+  int doorState = classifySensorValue(sensor, AppConfig.Doors[door].SensorRangeValues, sensor.Median);
+  if(doorState == DOOR_UNKNOWN) {
+    sensor.OutOfRangeCount++;
+  }
+
+  if(doorState == sensor.CandidateState) {
+    if(sensor.CandidateCount < AppConfig.DebounceReadCount) {
+      sensor.CandidateCount++;
+    }
+  }
+  else {
+    sensor.CandidateState = doorState;
+    sensor.CandidateCount = 1;
+    sensorActivity |= 1 << door;
+  }
+
+  if(sensor.CandidateState != DOOR_UNKNOWN && sensor.CandidateCount >= AppConfig.DebounceReadCount
+      && sensor.StableState != sensor.CandidateState) {
+    sensor.StableState = sensor.CandidateState;
+    sensorActivity |= 1 << door;
+  }
+}
+
+// The doors with sensor activity since the last call, as bits.
+// The ticker runs between loop() passes, not in the middle of one.
+uint8_t takeSensorActivity() {
+  uint8_t doors = sensorActivity;
+  sensorActivity = 0;
+  return doors;
+}
+
+// Runs from loop(), the ticker doesn't run in the middle of it.
+void logRawSensorSamples() {
+  int count = (rawSampleHead - rawSampleTail + RAW_SAMPLE_RING) % RAW_SAMPLE_RING;
+  if(count == 0 || (AppConfig.LogRawSensor && count < RAW_SAMPLE_LINE)) {
+    return;
+  }
+  for(int door = 0; door < DOOR_COUNT; door++) {
+    char buff[RAW_SAMPLE_LINE * 16 + 1]; // " 4294967295,1024" each
+    int len = 0, samples = 0;
+    for(int n = rawSampleTail; n != rawSampleHead; n = (n + 1) % RAW_SAMPLE_RING) {
+      if(rawSamples[n].Door != door) {
+        continue;
+      }
+      len += snprintf(buff + len, sizeof(buff) - len, " %lu,%u", (unsigned long) rawSamples[n].Ms, rawSamples[n].Value);
+      if(++samples == RAW_SAMPLE_LINE) {
+        log("Raw sensor door %d:%s", door, buff);
+        len = samples = 0;
+      }
+    }
+    if(samples > 0) {
+      log("Raw sensor door %d:%s", door, buff);
+    }
+  }
+  rawSampleTail = rawSampleHead;
+  if(rawSamplesDropped > 0) {
+    log("Raw sensor samples dropped: %lu", rawSamplesDropped);
+    rawSamplesDropped = 0;
+  }
+}
+
+void startSensorSampling() {
+#if DOOR_COUNT > 1
+  pinMode(SENSOR_SELECT_PIN, OUTPUT);
+  digitalWrite(SENSOR_SELECT_PIN, sampledDoor);
+#endif
+  sensorSamplePeriodMs = AppConfig.DebounceReadPauseMs;
+  sensorTicker.attach_ms(max(1, sensorSamplePeriodMs / DOOR_COUNT), sampleSensor);
+}
+
+// Returns the last stable door state, or DOOR_UNSTABLE while the readings don't agree with it.
+int getDoorState(int door) {
+  const DoorSensor& sensor = sensors[door];
+  if(sensor.StableState == DOOR_UNKNOWN || sensor.CandidateState != sensor.StableState) {
+    return DOOR_UNSTABLE;
+  }
+  return sensor.StableState;
+}
+
+int getSensorValue(int door) {
+  return sensors[door].Ema >> SENSOR_EMA_SHIFT;
+}
+
+// Groups the histogram into one cluster per door state (k-means, starting from the current ranges)
+// and proposes a range for each state from the buckets in its cluster.
+// Returns false if there isn't enough data.
+bool calibrateSensorRanges(int door, int ranges[DOOR_STATE_COUNT][2]) {
+  const DoorSensor& sensor = sensors[door];
+  const int (*current)[2] = AppConfig.Doors[door].SensorRangeValues;
+  if(sensor.HistogramTotal < SENSOR_CALIBRATION_MIN_SAMPLES) {
+    return false;
+  }
+
+  int centers[DOOR_STATE_COUNT];
+  for(int ds = 0; ds < DOOR_STATE_COUNT; ds++) {
+    centers[ds] = (current[ds][0] + current[ds][1]) / 2;
+  }
+
+  int8_t cluster[SENSOR_HIST_BUCKETS];
+  for(int iteration = 0; iteration < 10; iteration++) {
+    uint64_t sums[DOOR_STATE_COUNT] = { 0 };
+    uint32_t counts[DOOR_STATE_COUNT] = { 0 };
+    for(int b = 0; b < SENSOR_HIST_BUCKETS; b++) {
+      int value = (b << SENSOR_HIST_SHIFT) + (1 << (SENSOR_HIST_SHIFT - 1));
+      int nearest = 0;
+      for(int ds = 1; ds < DOOR_STATE_COUNT; ds++) {
+        if(abs(value - centers[ds]) < abs(value - centers[nearest])) {
+          nearest = ds;
+        }
+      }
+      cluster[b] = nearest;
+      sums[nearest] += (uint64_t) value * sensor.Histogram[b];
+      counts[nearest] += sensor.Histogram[b];
+    }
+    bool moved = false;
+    for(int ds = 0; ds < DOOR_STATE_COUNT; ds++) {
+      if(counts[ds] > 0 && (int)(sums[ds] / counts[ds]) != centers[ds]) {
+        centers[ds] = sums[ds] / counts[ds];
+        moved = true;
+      }
+    }
+    if(!moved) {
+      break;
+    }
+  }
+
+  for(int ds = 0; ds < DOOR_STATE_COUNT; ds++) {
+    ranges[ds][0] = current[ds][0];
+    ranges[ds][1] = current[ds][1];
+    int first = -1, last = -1;
+    bool split = false;
+    for(int b = 0; b < SENSOR_HIST_BUCKETS; b++) {
+      if(cluster[b] == ds && sensor.Histogram[b] >= SENSOR_CALIBRATION_MIN_BUCKET) {
+        if(first < 0) {
+          first = b;
+        }
+        else if(b - last > SENSOR_CALIBRATION_MAX_GAP + 1) {
+          split = true;
+        }
+        last = b;
+      }
+    }
+    if(first < 0 || split) {
+      // state not seen, or two separate groups of values: keep its range
+      centers[ds] = (current[ds][0] + current[ds][1]) / 2;
+      continue;
+    }
+    ranges[ds][0] = max(0, (first << SENSOR_HIST_SHIFT) - SENSOR_CALIBRATION_MARGIN);
+    ranges[ds][1] = min(1024, ((last + 1) << SENSOR_HIST_SHIFT) - 1 + SENSOR_CALIBRATION_MARGIN);
+  }
+
+  // neighbouring ranges stay apart: each ends short of the midpoint between the two centers
+  int order[DOOR_STATE_COUNT];
+  for(int ds = 0; ds < DOOR_STATE_COUNT; ds++) {
+    order[ds] = ds;
+  }
+  for(int i = 1; i < DOOR_STATE_COUNT; i++) {
+    for(int j = i; j > 0 && centers[order[j]] < centers[order[j - 1]]; j--) {
+      int t = order[j]; order[j] = order[j - 1]; order[j - 1] = t;
+    }
+  }
+  for(int i = 1; i < DOOR_STATE_COUNT; i++) {
+    int lower = order[i - 1], upper = order[i];
+    int mid = (centers[lower] + centers[upper]) / 2;
+    ranges[lower][1] = min(ranges[lower][1], mid - SENSOR_CALIBRATION_GUARD);
+    ranges[upper][0] = max(ranges[upper][0], mid + SENSOR_CALIBRATION_GUARD);
+  }
+  for(int ds = 0; ds < DOOR_STATE_COUNT; ds++) {
+    if(ranges[ds][0] > ranges[ds][1]) {
+      return false; // centers too close to tell the states apart
+    }
+  }
+  return true;
+}
+
+void reportSensorHistogram(int door) {
+  DoorSensor& sensor = sensors[door];
+  // two lines, as the whole histogram doesn't fit in a log message
+  for(int half = 0; half < 2; half++) {
+    char buff[400];
+    int len = 0;
+    for(int b = half * SENSOR_HIST_BUCKETS / 2; b < (half + 1) * SENSOR_HIST_BUCKETS / 2; b++) {
+      if(sensor.Histogram[b] > 0 && len < (int) sizeof(buff) - 16) {
+        len += snprintf(buff + len, sizeof(buff) - len, " %d:%lu", b << SENSOR_HIST_SHIFT, (unsigned long) sensor.Histogram[b]);
+      }
+    }
+    buff[len] = '\0';
+    log("Door %d sensor histogram %d/2 (%lu samples, %lu out of range):%s", door, half + 1,
+      (unsigned long) sensor.HistogramTotal, sensor.OutOfRangeCount, buff);
+  }
+
+  int ranges[DOOR_STATE_COUNT][2];
+  if(calibrateSensorRanges(door, ranges)) {
+    log("Door %d calibrated sensor ranges: Open [%d - %d], Closed [%d - %d], Ajar [%d - %d].%s", door,
+      ranges[DOOR_OPEN][0], ranges[DOOR_OPEN][1], ranges[DOOR_CLOSED][0], ranges[DOOR_CLOSED][1],
+      ranges[DOOR_AJAR][0], ranges[DOOR_AJAR][1], AppConfig.AutoCalibrateSensor ? " Applied." : "");
+    if(AppConfig.AutoCalibrateSensor) {
+      memcpy(SensorCalibration[door], ranges, sizeof(ranges));
+      memcpy(AppConfig.Doors[door].SensorRangeValues, ranges, sizeof(ranges));
+    }
+  }
+
+  // age the data
+  sensor.HistogramTotal = 0;
+  for(int b = 0; b < SENSOR_HIST_BUCKETS; b++) {
+    sensor.Histogram[b] /= 2;
+    sensor.HistogramTotal += sensor.Histogram[b];
+  }
+  sensor.OutOfRangeCount = 0;
+}
+
+void applySensorCalibration() {
+  if(!AppConfig.AutoCalibrateSensor) {
+    return;
+  }
+  for(int door = 0; door < DOOR_COUNT; door++) {
+    const int (*ranges)[2] = SensorCalibration[door];
+    if(ranges[DOOR_OPEN][1] != 0 || ranges[DOOR_CLOSED][1] != 0 || ranges[DOOR_AJAR][1] != 0) {
+      memcpy(AppConfig.Doors[door].SensorRangeValues, SensorCalibration[door], sizeof(SensorCalibration[door]));
+    }
+  }
+}
+
+#define SEND_SENSOR_STAT_INTERVAL (24 * 60 * 60 * 1000) // 24 hours
+unsigned long lastSensorStatSent = 0;
+
+void serviceSensor() {
+  if(sensorSamplePeriodMs != AppConfig.DebounceReadPauseMs) {
+    startSensorSampling(); // sample period changed
+  }
+
+  if(millis() - lastSensorStatSent > SEND_SENSOR_STAT_INTERVAL) {
+    for(int door = 0; door < DOOR_COUNT; door++) {
+      reportSensorHistogram(door);
+    }
+    lastSensorStatSent = millis();
+  }
+}
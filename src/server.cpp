@@ -0,0 +1,90 @@
+#include <Arduino.h>
+#include <TimeLib.h>
+#include <ArduinoJson.h>
+#include <ESP8266WiFi.h>
+#include <ESP8266WebServer.h>
+#include <main.h>
+#include <metrics.h>
+
+// Local status server, for monitoring to poll the device on demand.
+// Serviced from loop(), it never waits for a client.
+// A page that doesn't fit is answered with 500, never cut short.
+#define STATUS_SERVER_PORT  80
+#define STATUS_PAGE_LEN     (CONFIG_BODY_SIZE + 512) // the metrics are a bit longer than a config
+
+ESP8266WebServer statusServer(STATUS_SERVER_PORT);
+char statusPage[STATUS_PAGE_LEN];
+
+void sendStatusPage(const char* contentType, size_t len) {
+  if(len >= STATUS_PAGE_LEN - 1) {
+    log("Status page doesn't fit in %d bytes.", STATUS_PAGE_LEN);
+    statusServer.send(500, "text/plain", "Status page too long.");
+    return;
+  }
+  statusServer.send(200, contentType, statusPage);
+}
+
+#define DOOR_STATE_FIELDS   7
+
+void addDoorState(JsonObject& state, int door, unsigned long nowMs) {
+  int doorState = getDoorState(door);
+  state["door"] = getNamedDoorState(doorState);
+  state["doorState"] = doorState;
+  state["sensorValue"] = getSensorValue(door);
+  state["closing"] = isClosingDoor(door);
+  state["doorOpenedSinceMs"] = doorOpenedSinceMs[door];
+  state["doorOpenForMs"] = doorOpenedSinceMs[door] != 0 ? nowMs - doorOpenedSinceMs[door] : 0;
+  state["lastCloseAttemptMs"] = lastCloseAttemptMs[door];
+}
+
+// Door 0 at the top level. With more doors, all of them are in "doors" as well.
+void handleStateRequest() {
+  StaticJsonBuffer<JSON_OBJECT_SIZE(DOOR_STATE_FIELDS + 11)
+    + JSON_ARRAY_SIZE(DOOR_COUNT) + DOOR_COUNT * JSON_OBJECT_SIZE(DOOR_STATE_FIELDS)> jsonBuffer;
+  JsonObject& state = jsonBuffer.createObject();
+  unsigned long nowMs = millis();
+
+  addDoorState(state, 0, nowMs);
+#if DOOR_COUNT > 1
+  JsonArray& doors = state.createNestedArray("doors");
+  for(int door = 0; door < DOOR_COUNT; door++) {
+    addDoorState(doors.createNestedObject(), door, nowMs);
+  }
+#endif
+  state["uptimeMs"] = nowMs;
+  state["timeSet"] = timeSet == timeStatus();
+  state["time"] = (unsigned long) now();
+  state["timeSource"] = getNamedTimeSource(IotTimeSync.Source);
+  state["timeConfidence"] = getNamedTimeConfidence(timeConfidence());
+  state["timeErrorMs"] = (long) timeErrorMs();
+  state["clockDriftPpm"] = IotTimeSync.DriftPpm;
+  state["wifiState"] = getNamedWiFiState();
+  state["wifiRssi"] = WiFi.RSSI();
+  state["version"] = GDOOR_MONITOR_VERSION;
+
+  sendStatusPage("application/json", state.printTo(statusPage, STATUS_PAGE_LEN));
+}
+
+void handleConfigRequest() {
+  sendStatusPage("application/json", formatConfig(statusPage, STATUS_PAGE_LEN));
+}
+
+void handleMetricsRequest() {
+  sendStatusPage("text/plain", formatMetrics(statusPage, STATUS_PAGE_LEN));
+}
+
+void handleUnknownRequest() {
+  statusServer.send(404, "text/plain", "Not found. Try /state, /config or /metrics.");
+}
+
+void startStatusServer() {
+  statusServer.on("/state", handleStateRequest);
+  statusServer.on("/config", handleConfigRequest);
+  statusServer.on("/metrics", handleMetricsRequest);
+  statusServer.onNotFound(handleUnknownRequest);
+  statusServer.begin();
+}
+
+void serviceStatusServer() {
+  statusServer.handleClient();
+}
@@ -0,0 +1,286 @@
+#include <Arduino.h>
+#include <TimeLib.h>
+#include <ESP8266WiFi.h>
+#include <WiFiUdp.h>
+#include <limits.h>
+#include <main.h>
+
+// Wall clock kept from SNTP, with the X-IoT-LocalTime header of the config pull as fallback.
+// The crystal's drift is measured between SNTP samples and corrected for, and the clock
+// carries an error bound that grows with the time since the last sync.
+// TimeLib reads the corrected local time through its sync provider, and sees no time
+// once the error bound is too large for the time of day logic.
+
+#ifndef NTP_SERVER
+#define NTP_SERVER          "pool.ntp.org"
+#endif
+#define NTP_PORT            123
+#define NTP_LOCAL_PORT      2390
+#define NTP_PACKET_SIZE     48
+#define NTP_UNIX_OFFSET     2208988800UL  // 1900 to 1970
+#define NTP_TIMEOUT_MS      2000
+#define NTP_RETRY_MS        (30UL * 1000)
+
+#define TIME_MAX_ERROR_MS       (60UL * 1000) // worse than this, the time is not used
+#define TIME_GOOD_ERROR_MS      2000
+#define DRIFT_UNKNOWN_PPM       100     // error growth before the drift is measured
+#define DRIFT_RESIDUAL_PPM      5       // error growth once it is corrected for
+#define DRIFT_MAX_PPM           500
+#define DRIFT_MIN_INTERVAL_MS   (10UL * 60 * 1000)
+#define TZ_STEP_SEC             (15 * 60)
+
+TimeSyncStats IotTimeSync;
+
+uint64_t timeBaseUtcMs = 0;         // utc at timeBaseMillis
+unsigned long timeBaseMillis = 0;
+unsigned long timeBaseErrorMs = 0;  // error bound at the last sync
+bool tzOffsetKnown = false;
+
+uint64_t lastSntpUtcMs = 0;         // last SNTP sample, for measuring the drift
+unsigned long lastSntpMillis = 0;
+
+WiFiUDP ntpUdp;
+uint8_t ntpPacket[NTP_PACKET_SIZE];
+bool ntpWaiting = false;
+unsigned long ntpSentMs = 0;
+unsigned long lastNtpTryMs = 0;
+
+unsigned long timeSinceSyncMs() {
+  return millis() - timeBaseMillis;
+}
+
+uint64_t utcNowMs() {
+  if(TIME_SOURCE_NONE == IotTimeSync.Source) {
+    return 0;
+  }
+  unsigned long elapsed = timeSinceSyncMs();
+  return timeBaseUtcMs + elapsed + (int64_t)(elapsed * (double)IotTimeSync.DriftPpm / 1e6);
+}
+
+unsigned long timeErrorMs() {
+  if(TIME_SOURCE_NONE == IotTimeSync.Source) {
+    return ULONG_MAX;
+  }
+  uint64_t growth = (uint64_t)timeSinceSyncMs() * (IotTimeSync.DriftKnown ? DRIFT_RESIDUAL_PPM : DRIFT_UNKNOWN_PPM) / 1000000;
+  return min((uint64_t)ULONG_MAX, timeBaseErrorMs + growth);
+}
+
+int timeConfidence() {
+  unsigned long errorMs = timeErrorMs();
+  if(!tzOffsetKnown || errorMs > TIME_MAX_ERROR_MS) {
+    return TIME_CONFIDENCE_NONE;
+  }
+  return errorMs > TIME_GOOD_ERROR_MS ? TIME_CONFIDENCE_LOW : TIME_CONFIDENCE_GOOD;
+}
+
+const char* timeConfidenceNames[] = { "none", "low", "good" };
+const char* timeSourceNames[] = { "none", "header", "sntp", "restored" };
+
+const char* getNamedTimeConfidence(int confidence) {
+  return timeConfidenceNames[confidence];
+}
+
+const char* getNamedTimeSource(int source) {
+  return timeSourceNames[source];
+}
+
+// TimeLib sync provider: local time, or 0 (no time) when it can't be trusted.
+time_t getSyncedTime() {
+  if(TIME_CONFIDENCE_NONE == timeConfidence()) {
+    return 0;
+  }
+  return (time_t)(utcNowMs() / 1000) + IotTimeSync.TzOffsetSec;
+}
+
+void setTimeBase(uint64_t utcMs, unsigned long errorMs, int source) {
+  timeBaseUtcMs = utcMs;
+  timeBaseMillis = millis();
+  timeBaseErrorMs = errorMs;
+  IotTimeSync.Source = source;
+  IotTimeSync.LastSyncMs = timeBaseMillis;
+  setSyncProvider(getSyncedTime); // syncs TimeLib right away
+}
+
+// Offsets are whole quarter hours; the sample pair only has to be within a few minutes.
+void learnTzOffset(time_t localTime, time_t utcTime) {
+  long offset = (long)(localTime - utcTime);
+  offset = (offset + (offset >= 0 ? TZ_STEP_SEC / 2 : -TZ_STEP_SEC / 2)) / TZ_STEP_SEC * TZ_STEP_SEC;
+  if(!tzOffsetKnown || offset != IotTimeSync.TzOffsetSec) {
+    log("Time zone offset: %ld minutes.", offset / 60);
+    IotTimeSync.TzOffsetSec = offset;
+    tzOffsetKnown = true;
+  }
+}
+
+void syncTimeFromSntp(uint64_t utcMs, unsigned long errorMs) {
+  unsigned long nowMs = millis();
+  IotTimeSync.SntpSyncs++;
+  if(lastSntpUtcMs != 0 && nowMs - lastSntpMillis >= DRIFT_MIN_INTERVAL_MS) {
+    // how much faster the real clock ran than millis() since the last sample
+    long elapsed = nowMs - lastSntpMillis;
+    float ppm = ((int64_t)(utcMs - lastSntpUtcMs) - elapsed) * 1e6f / elapsed;
+    if(fabsf(ppm) <= DRIFT_MAX_PPM) {
+      IotTimeSync.DriftPpm = IotTimeSync.DriftKnown ? (IotTimeSync.DriftPpm * 3 + ppm) / 4 : ppm;
+      IotTimeSync.DriftKnown = true;
+    }
+    else {
+      logd("Clock drift of %ld ppm ignored.", (long)ppm);
+    }
+  }
+  if(lastSntpUtcMs == 0 || nowMs - lastSntpMillis >= DRIFT_MIN_INTERVAL_MS) {
+    lastSntpUtcMs = utcMs;
+    lastSntpMillis = nowMs;
+  }
+
+  if(TIME_SOURCE_HEADER == IotTimeSync.Source) {
+    // the header clock is local time, shifted by the offset known so far
+    learnTzOffset((time_t)(utcNowMs() / 1000) + IotTimeSync.TzOffsetSec, (time_t)(utcMs / 1000));
+  }
+  if(TIME_SOURCE_SNTP == IotTimeSync.Source) {
+    IotTimeSync.LastOffsetMs = (long)(int64_t)(utcMs - utcNowMs());
+  }
+  setTimeBase(utcMs, errorMs, TIME_SOURCE_SNTP);
+  logd("SNTP time synced, offset %ld ms, error %lu ms, drift %ld ppb.",
+    IotTimeSync.LastOffsetMs, errorMs, (long)(IotTimeSync.DriftPpm * 1000));
+}
+
+// The header has local time to the second. It sets the clock only when nothing better is
+// known, and tells the time zone offset from the SNTP time.
+void syncTimeFromHeader(time_t localTime, unsigned long latencyMs) {
+  unsigned long errorMs = 1000 + latencyMs;
+  IotTimeSync.HeaderSyncs++;
+
+  if(TIME_SOURCE_SNTP == IotTimeSync.Source && timeErrorMs() < TIME_GOOD_ERROR_MS) {
+    learnTzOffset(localTime, (time_t)(utcNowMs() / 1000));
+    setSyncProvider(getSyncedTime);
+    return;
+  }
+  if(timeErrorMs() <= errorMs) {
+    return;
+  }
+  // until SNTP works, the header is the time, in the zone known so far (none at first)
+  tzOffsetKnown = true;
+  setTimeBase(((uint64_t)localTime - IotTimeSync.TzOffsetSec) * 1000 + latencyMs / 2, errorMs, TIME_SOURCE_HEADER);
+}
+
+// What persist.cpp carries over a reset.
+void checkpointTime(TimeCheckpoint& cp) {
+  cp.UtcMs = utcNowMs();
+  cp.ErrorMs = 0 == cp.UtcMs ? 0 : min(timeErrorMs(), (unsigned long)UINT32_MAX);
+  cp.TzOffsetSec = IotTimeSync.TzOffsetSec;
+  cp.DriftPpm = IotTimeSync.DriftPpm;
+  cp.DriftKnown = IotTimeSync.DriftKnown;
+  cp.TzOffsetKnown = tzOffsetKnown;
+}
+
+// The clock goes on from the checkpoint, its error grown by up to gapMs between the checkpoint
+// and the reset. A checkpoint without utc, e.g. after a power cut, only brings back the zone and drift.
+void restoreTime(const TimeCheckpoint& cp, unsigned long gapMs) {
+  IotTimeSync.TzOffsetSec = cp.TzOffsetSec;
+  tzOffsetKnown = cp.TzOffsetKnown;
+  IotTimeSync.DriftKnown = cp.DriftKnown;
+  IotTimeSync.DriftPpm = cp.DriftKnown ? cp.DriftPpm : 0;
+  if(0 == cp.UtcMs) {
+    return;
+  }
+  setTimeBase(cp.UtcMs + millis() + gapMs / 2, cp.ErrorMs + gapMs / 2, TIME_SOURCE_RESTORED);
+  log("Time restored, error %lu ms, confidence: %s.", timeErrorMs(), getNamedTimeConfidence(timeConfidence()));
+}
+
+void sendNtpRequest() {
+  memset(ntpPacket, 0, NTP_PACKET_SIZE);
+  ntpPacket[0] = 0x1b; // no leap warning, version 3, client
+  // transmit timestamp: a cookie the server echoes back as the originate timestamp
+  ntpSentMs = millis();
+  for(int n = 0; n < 4; n++) {
+    ntpPacket[44 + n] = (ntpSentMs >> (24 - 8 * n)) & 0xff;
+  }
+  ntpUdp.begin(NTP_LOCAL_PORT);
+  if(!ntpUdp.beginPacket(NTP_SERVER, NTP_PORT)) {
+    IotTimeSync.SntpFailures++;
+    return;
+  }
+  ntpUdp.write(ntpPacket, NTP_PACKET_SIZE);
+  ntpWaiting = ntpUdp.endPacket();
+  if(!ntpWaiting) {
+    IotTimeSync.SntpFailures++;
+  }
+}
+
+uint32_t readNtpUint32(int offset) {
+  return ((uint32_t)ntpPacket[offset] << 24) | ((uint32_t)ntpPacket[offset + 1] << 16)
+    | ((uint32_t)ntpPacket[offset + 2] << 8) | ntpPacket[offset + 3];
+}
+
+uint64_t readNtpTimeMs(int offset) {
+  uint64_t secs = readNtpUint32(offset) - NTP_UNIX_OFFSET;
+  return secs * 1000 + (((uint64_t)readNtpUint32(offset + 4) * 1000) >> 32);
+}
+
+bool readNtpResponse() {
+  if(ntpUdp.parsePacket() < NTP_PACKET_SIZE) {
+    return false;
+  }
+  unsigned long receivedMs = millis();
+  ntpUdp.read(ntpPacket, NTP_PACKET_SIZE);
+
+  int leap = ntpPacket[0] >> 6;
+  int mode = ntpPacket[0] & 0x07;
+  int stratum = ntpPacket[1];
+  if(mode != 4 || stratum == 0 || leap == 3 || readNtpUint32(28) != ntpSentMs) {
+    logd("Bad SNTP response: mode %d, stratum %d, leap %d.", mode, stratum, leap);
+    IotTimeSync.SntpFailures++;
+    return true;
+  }
+
+  // utc at reception: server transmit time plus half of the network delay
+  uint64_t serverRxMs = readNtpTimeMs(32);
+  uint64_t serverTxMs = readNtpTimeMs(40);
+  unsigned long roundTripMs = receivedMs - ntpSentMs;
+  long serverMs = (long)(serverTxMs - serverRxMs);
+  unsigned long delayMs = roundTripMs > (unsigned long)max(serverMs, 0L) ? roundTripMs - max(serverMs, 0L) : 0;
+  syncTimeFromSntp(serverTxMs + delayMs / 2, delayMs / 2 + 1);
+  return true;
+}
+
+// Called from loop(): one SNTP exchange every TimeSyncMs, never waiting for the answer.
+void serviceTimeSync() {
+  if(ntpWaiting) {
+    if(readNtpResponse()) {
+      ntpWaiting = false;
+      ntpUdp.stop();
+    }
+    else if(millis() - ntpSentMs > NTP_TIMEOUT_MS) {
+      logd("SNTP request to %s timed out.", NTP_SERVER);
+      IotTimeSync.SntpFailures++;
+      ntpWaiting = false;
+      ntpUdp.stop();
+    }
+    return;
+  }
+
+  unsigned long interval = TIME_SOURCE_SNTP == IotTimeSync.Source ? AppConfig.TimeSyncMs : NTP_RETRY_MS;
+  if(lastNtpTryMs != 0 && millis() - lastNtpTryMs < interval) {
+    return;
+  }
+  if(!wifiConnected()) {
+    return;
+  }
+  lastNtpTryMs = millis();
+  if(0 == lastNtpTryMs) {
+    lastNtpTryMs = 1;
+  }
+  sendNtpRequest();
+}
+
+void startTimeSync() {
+  setSyncInterval(60);
+}
+
+size_t formatTimeMetrics(char* buff, size_t size) {
+  unsigned long errorMs = timeErrorMs();
+  return snprintf(buff, size, "time source=%s confidence=%s error=%ld ms drift=%ld ppb sntp=%lu failed=%lu header=%lu",
+    getNamedTimeSource(IotTimeSync.Source), getNamedTimeConfidence(timeConfidence()),
+    errorMs == ULONG_MAX ? -1L : (long)errorMs, (long)(IotTimeSync.DriftPpm * 1000),
+    IotTimeSync.SntpSyncs, IotTimeSync.SntpFailures, IotTimeSync.HeaderSyncs);
+}
@@ -0,0 +1,80 @@
+#include <Arduino.h>
+#include <main.h>
+
+// Learned door travel time: from pressing the switch on an open door to the sensor reading closed.
+// Each door keeps a rolling mean and variance over about the last TRAVEL_WINDOW closes, kept in
+// flash with the door state. A close well above the usual time, or close to DoorClosingTimeMs,
+// is reported: the opener is getting slower before it starts to fail. A door still not closed
+// past the learned limit is reported while it moves; the close itself isn't cut short for it.
+
+#define TRAVEL_WINDOW           16      // closes the rolling values mostly come from
+#define TRAVEL_MIN_SAMPLES      5       // before the profile is trusted
+#define TRAVEL_SLOW_SIGMAS      3
+#define TRAVEL_SLOW_MIN_MS      1000    // smaller slowdowns are not reported, however steady the door
+#define TRAVEL_STALL_SIGMAS     4
+#define TRAVEL_STALL_MIN_MS     3000
+
+TravelProfile DoorTravel[DOOR_COUNT];
+
+unsigned long travelSdMs(const TravelProfile& profile) {
+  return sqrtf(profile.VarMs2);
+}
+
+bool travelLearned(const TravelProfile& profile) {
+  return profile.Count >= TRAVEL_MIN_SAMPLES;
+}
+
+// How long a close may take before it is reported as slow while still under way, 0 while not learned.
+unsigned long travelLimitMs(int door) {
+  const TravelProfile& profile = DoorTravel[door];
+  if(!travelLearned(profile)) {
+    return 0;
+  }
+  return profile.MeanMs + max((unsigned long) TRAVEL_STALL_MIN_MS, TRAVEL_STALL_SIGMAS * travelSdMs(profile));
+}
+
+void reportSlowDoor(int door, unsigned long travelMs) {
+  TravelProfile& profile = DoorTravel[door];
+  char buff[24];
+  profile.Slow++;
+  const char* logmsg = log("Door %d not closed after %s, usually %lu ms (sd %lu ms).", door,
+    formatMillis(buff, travelMs), (unsigned long) profile.MeanMs, travelSdMs(profile));
+  sendNotification(IOT_EVENT_SLOW_DOOR, logmsg, -1, door);
+}
+
+// slowReported: reportSlowDoor() was already called for this close.
+void recordDoorTravel(int door, unsigned long travelMs, bool slowReported) {
+  TravelProfile& profile = DoorTravel[door];
+  unsigned long slowMs = profile.MeanMs + max((unsigned long) TRAVEL_SLOW_MIN_MS, TRAVEL_SLOW_SIGMAS * travelSdMs(profile));
+  bool slow = slowReported || (travelLearned(profile) && travelMs > slowMs) || travelMs > AppConfig.DoorClosingTimeMs / 4 * 3;
+
+  if(slow) {
+    char buff[24];
+    const char* logmsg = log("Door %d took %s to close, usually %lu ms (sd %lu ms).", door,
+      formatMillis(buff, travelMs), (unsigned long) profile.MeanMs, travelSdMs(profile));
+    if(!slowReported) {
+      profile.Slow++;
+      sendNotification(IOT_EVENT_SLOW_DOOR, logmsg, -1, door);
+    }
+  }
+  else {
+    logd("Door %d closed in %lu ms, usually %lu ms (sd %lu ms).", door, travelMs, (unsigned long) profile.MeanMs, travelSdMs(profile));
+  }
+  journalEvent(JOURNAL_DOOR_TRAVEL, slow, min(travelMs / 100, 0xffffUL), door);
+
+  // exponentially weighted, the first closes count equally
+  if(profile.Count < 0xffff) {
+    profile.Count++;
+  }
+  float alpha = 1.0f / min((int) profile.Count, TRAVEL_WINDOW);
+  float diff = travelMs - profile.MeanMs;
+  profile.MeanMs += alpha * diff;
+  profile.VarMs2 = (1 - alpha) * (profile.VarMs2 + alpha * diff * diff);
+  profile.LastMs = travelMs;
+}
+
+size_t formatTravelMetrics(char* buff, size_t size, int door) {
+  const TravelProfile& profile = DoorTravel[door];
+  return snprintf(buff, size, "travel door=%d closes=%u mean=%lu sd=%lu last=%lu slow=%u ms", door,
+    profile.Count, (unsigned long) profile.MeanMs, travelSdMs(profile), (unsigned long) profile.LastMs, profile.Slow);
+}
@@ -2,30 +2,208 @@
 #include <ESP8266WiFi.h>
 #include <sensitive.h>
 #include <main.h>
+#include <metrics.h>
 
-void setupWiFi() {
-  log("Setting up Wifi.");
+// WiFi connection kept up by a state machine advanced from loop(), it never waits.
+// The access point (BSSID, channel) and the DHCP lease of the last good connection are kept
+// in RTC memory, which survives a reset. A connect tries them first, skipping the scan and DHCP,
+// and falls back to a full connect when that doesn't work in a few seconds.
+// The lease time isn't known, so a cached lease is only reused for WIFI_LEASE_MAX_S after
+// DHCP gave it; its age is counted in the cache too, across resets.
+
+#define WIFI_RTC_OFFSET         0       // in 4 byte blocks
+#define WIFI_FAST_TIMEOUT_MS    5000
+#define WIFI_FULL_TIMEOUT_MS    (30UL * 1000)
+#define WIFI_RETRY_MIN_MS       (5UL * 1000)
+#define WIFI_RETRY_MAX_MS       (5UL * 60 * 1000)
+#define WIFI_LEASE_MAX_S        (4UL * 60 * 60)
+#define WIFI_LEASE_TICK_MS      (60UL * 1000)
+
+#define WIFI_STATE_DOWN         0 // waiting to retry
+#define WIFI_STATE_FAST         1 // connecting with the cached access point and lease
+#define WIFI_STATE_FULL         2 // connecting with scan and DHCP
+#define WIFI_STATE_UP           3
+
+struct WiFiCache {
+  uint32_t Check;       // hash of the rest, 0 when the cache is not usable
+  uint8_t Bssid[6];
+  uint8_t Channel;
+  uint8_t Reserved;
+  uint32_t Ip;
+  uint32_t Gateway;
+  uint32_t Subnet;
+  uint32_t Dns;
+  uint32_t LeaseAgeS;   // since DHCP gave the lease, counted while connected
+};
+static_assert(sizeof(WiFiCache) <= 16 * 4, "the persisted state follows in RTC memory");
+
+WiFiStats IotWiFiStats;
+
+WiFiCache wifiCache;
+int wifiState = WIFI_STATE_DOWN;
+unsigned long wifiAttemptMs = 0;
+unsigned long wifiRetryMs = WIFI_RETRY_MIN_MS;
+unsigned long wifiDownSinceMs = 0;
+unsigned long wifiLeaseTickMs = 0;
+bool wifiLeaseReused = false; // connected with the cached lease, DHCP doesn't renew it
+
+const char* wifiStateNames[] = { "down", "fast", "full", "up" };
+
+const char* getNamedWiFiState() {
+  return wifiStateNames[wifiState];
+}
+
+uint32_t wifiCacheCheck(const WiFiCache& cache) {
+  return hashText((const char*) &cache + sizeof(cache.Check), sizeof(cache) - sizeof(cache.Check));
+}
+
+bool wifiCacheValid() {
+  return wifiCache.Check != 0 && wifiCache.Check == wifiCacheCheck(wifiCache);
+}
+
+void loadWiFiCache() {
+  if(!ESP.rtcUserMemoryRead(WIFI_RTC_OFFSET, (uint32_t*) &wifiCache, sizeof(wifiCache)) || !wifiCacheValid()) {
+    memset(&wifiCache, 0, sizeof(wifiCache));
+  }
+}
+
+void writeWiFiCache() {
+  wifiCache.Check = wifiCacheCheck(wifiCache);
+  ESP.rtcUserMemoryWrite(WIFI_RTC_OFFSET, (uint32_t*) &wifiCache, sizeof(wifiCache));
+}
 
-  WiFi.disconnect();
-  delay(5 * 1000);
+void saveWiFiCache() {
+  memcpy(wifiCache.Bssid, WiFi.BSSID(), sizeof(wifiCache.Bssid));
+  wifiCache.Channel = WiFi.channel();
+  wifiCache.Ip = WiFi.localIP();
+  wifiCache.Gateway = WiFi.gatewayIP();
+  wifiCache.Subnet = WiFi.subnetMask();
+  wifiCache.Dns = WiFi.dnsIP();
+  if(!wifiLeaseReused) {
+    wifiCache.LeaseAgeS = 0;
+  }
+  writeWiFiCache();
+}
+
+void dropWiFiCache() {
+  wifiCache.Check = 0;
+  ESP.rtcUserMemoryWrite(WIFI_RTC_OFFSET, (uint32_t*) &wifiCache, sizeof(wifiCache));
+}
 
+void beginWiFiConnect(bool fast) {
+  TIME_STAGE(STAGE_WIFI_CONNECT);
+  wifiAttemptMs = millis();
+  if(fast && wifiCacheValid() && wifiCache.LeaseAgeS >= WIFI_LEASE_MAX_S) {
+    logd("WiFi lease is %lu s old, renewing it.", (unsigned long) wifiCache.LeaseAgeS);
+    fast = false;
+  }
+  if(fast && wifiCacheValid()) {
+    WiFi.config(IPAddress(wifiCache.Ip), IPAddress(wifiCache.Gateway), IPAddress(wifiCache.Subnet), IPAddress(wifiCache.Dns));
+    WiFi.begin(WIFI_NETWORK, WIFI_PASSWORD, wifiCache.Channel, wifiCache.Bssid);
+    wifiState = WIFI_STATE_FAST;
+  }
+  else {
+    WiFi.config(0U, 0U, 0U); // use DHCP
+    WiFi.begin(WIFI_NETWORK, WIFI_PASSWORD);
+    wifiState = WIFI_STATE_FULL;
+  }
+  logd("WiFi connecting (%s).", getNamedWiFiState());
+}
+
+void wifiConnectDone() {
+  unsigned long connectMs = millis() - wifiAttemptMs;
+  IotWiFiStats.Connects++;
+  if(WIFI_STATE_FAST == wifiState) {
+    IotWiFiStats.FastConnects++;
+  }
+  IotWiFiStats.LastConnectMs = connectMs;
+  IotWiFiStats.MaxConnectMs = max(IotWiFiStats.MaxConnectMs, connectMs);
+  IotWiFiStats.TotalConnectMs += connectMs;
+  IotWiFiStats.LastDownMs = millis() - wifiDownSinceMs;
+  wifiRetryMs = WIFI_RETRY_MIN_MS;
+
+  IPAddress ip = WiFi.localIP();
+  log("WiFi connected (%s) in %lu ms, down for %lu ms. %d.%d.%d.%d %s", getNamedWiFiState(), connectMs,
+    IotWiFiStats.LastDownMs, ip[0], ip[1], ip[2], ip[3], WiFi.macAddress().c_str());
+  wifiLeaseReused = (WIFI_STATE_FAST == wifiState);
+  wifiLeaseTickMs = millis();
+  wifiState = WIFI_STATE_UP;
+  saveWiFiCache();
+}
+
+// Counts the lease age while connected. A reused lease is given up once it's too old.
+void tickWiFiLease() {
+  if(millis() - wifiLeaseTickMs < WIFI_LEASE_TICK_MS || !wifiCacheValid()) {
+    return;
+  }
+  wifiLeaseTickMs += WIFI_LEASE_TICK_MS;
+  wifiCache.LeaseAgeS += WIFI_LEASE_TICK_MS / 1000;
+  writeWiFiCache();
+  if(wifiLeaseReused && wifiCache.LeaseAgeS >= WIFI_LEASE_MAX_S) {
+    log("WiFi reconnecting for a new lease.");
+    WiFi.disconnect();
+    wifiDownSinceMs = millis();
+    beginWiFiConnect(false);
+  }
+}
+
+void startWiFi() {
+  log("Setting up Wifi.");
   WiFi.persistent(false);
-  WiFi.mode(WIFI_OFF);
+  WiFi.setAutoReconnect(false); // reconnects are done here
   WiFi.mode(WIFI_STA);
-  WiFi.config(0U, 0U, 0U); // use DHCP
   WiFi.setHostname("iotGarageDoor");
-  WiFi.begin(WIFI_NETWORK, WIFI_PASSWORD);
+  loadWiFiCache();
+  wifiDownSinceMs = millis();
+  beginWiFiConnect(true);
+}
 
-  delay(15 * 1000);
-  for(int n = 0; n < 8; n++) {
-    if(WiFi.status() == WL_CONNECTED) {
-        break;
-    }
-    delay(5 * 1000);
-  }
+// Called from loop(), and by the network users before their requests.
+void serviceWiFi() {
+  bool connected = wifiConnected();
+  unsigned long elapsed = millis() - wifiAttemptMs;
 
-  IPAddress ip = WiFi.localIP();
-  log("WiFi setup done. %d.%d.%d.%d %s", ip[0], ip[1], ip[2], ip[3], WiFi.macAddress().c_str());
+  switch(wifiState) {
+    case WIFI_STATE_UP:
+      if(!connected) {
+        log("WiFi connection lost.");
+        IotWiFiStats.Drops++;
+        wifiDownSinceMs = millis();
+        beginWiFiConnect(true);
+      }
+      else {
+        tickWiFiLease();
+      }
+      break;
+
+    case WIFI_STATE_FAST:
+    case WIFI_STATE_FULL:
+      if(connected) {
+        wifiConnectDone();
+      }
+      else if(WIFI_STATE_FAST == wifiState && elapsed > WIFI_FAST_TIMEOUT_MS) {
+        logd("WiFi fast connect failed.");
+        IotWiFiStats.FastFailures++;
+        dropWiFiCache(); // the access point or the lease has changed
+        WiFi.disconnect();
+        beginWiFiConnect(false);
+      }
+      else if(WIFI_STATE_FULL == wifiState && elapsed > WIFI_FULL_TIMEOUT_MS) {
+        IotWiFiStats.Failures++;
+        log("WiFi connect failed, retrying in %lu s.", wifiRetryMs / 1000);
+        WiFi.disconnect();
+        wifiState = WIFI_STATE_DOWN;
+        wifiAttemptMs = millis();
+      }
+      break;
+
+    default:
+      if(elapsed > wifiRetryMs) {
+        wifiRetryMs = min(wifiRetryMs * 2, WIFI_RETRY_MAX_MS);
+        beginWiFiConnect(true);
+      }
+      break;
+  }
 }
 
 bool wifiConnected() {
@@ -33,8 +211,13 @@ bool wifiConnected() {
 }
 
 bool ensureWiFi() {
-  if(!wifiConnected()) {
-    setupWiFi();
-  }
-  return wifiConnected();
-}
\ No newline at end of file
+  serviceWiFi();
+  return WIFI_STATE_UP == wifiState;
+}
+
+size_t formatWiFiMetrics(char* buff, size_t size) {
+  return snprintf(buff, size, "wifi state=%s connects=%lu fast=%lu fastFailed=%lu failed=%lu drops=%lu last=%lu max=%lu avg=%lu ms",
+    getNamedWiFiState(), IotWiFiStats.Connects, IotWiFiStats.FastConnects, IotWiFiStats.FastFailures,
+    IotWiFiStats.Failures, IotWiFiStats.Drops, IotWiFiStats.LastConnectMs, IotWiFiStats.MaxConnectMs,
+    IotWiFiStats.Connects ? IotWiFiStats.TotalConnectMs / IotWiFiStats.Connects : 0);
+}
@@ -0,0 +1,155 @@
+#!/usr/bin/env python3
+"""Decodes the binary log batches of a LOG_BINARY build back into text.
+
+The device only sends the FNV-1a hash of each logd() format string; the
+formats are recovered by scanning the firmware sources, so decode with the
+same source tree the firmware was built from.
+
+Usage: logdecode.py [--src DIR]... [FILE]
+  FILE     concatenated batches as posted to /log, binary or text (stdin by default)
+  --src    source directory to scan for logd() calls, src and include by default
+"""
+
+import argparse
+import datetime
+import os
+import re
+import struct
+import sys
+
+HEADER = struct.Struct("<2sBBIIIHH")
+MAGIC = b"GL\x01\x00"
+LOGD_CALL = re.compile(r'\blogd\(\s*((?:"(?:[^"\\]|\\.)*"\s*)+)')
+LITERAL = re.compile(r'"((?:[^"\\]|\\.)*)"')
+CONVERSION = re.compile(r'%([-+ #0]*)(\d*)(?:\.(\d+))?(hh|h|ll|l|z|j|t)?([diouxXcsfFeEgGp%])')
+
+
+def fnv1a(data):
+    h = 2166136261
+    for b in data:
+        h = ((h ^ b) * 16777619) & 0xFFFFFFFF
+    return h
+
+
+def unescape(text):
+    return text.encode("latin-1").decode("unicode_escape").encode("latin-1")
+
+
+def scan_formats(dirs):
+    formats = {}
+    for top in dirs:
+        for root, _, files in os.walk(top):
+            for name in files:
+                if not name.endswith((".cpp", ".h")):
+                    continue
+                with open(os.path.join(root, name), encoding="latin-1") as f:
+                    source = f.read()
+                for call in LOGD_CALL.finditer(source):
+                    fmt = b"".join(unescape(s) for s in LITERAL.findall(call.group(1)))
+                    fid = fnv1a(fmt)
+                    if fid in formats and formats[fid] != fmt:
+                        print("warning: format id collision %08x" % fid, file=sys.stderr)
+                    formats[fid] = fmt
+    return formats
+
+
+def read_varint(data, pos):
+    value = shift = 0
+    while True:
+        b = data[pos]
+        pos += 1
+        value |= (b & 0x7F) << shift
+        shift += 7
+        if not b & 0x80:
+            return value, pos
+
+
+def format_record(fmt, args, pos):
+    """Formats with the record's arguments, the format string tells their types."""
+    out = []
+    last = 0
+    for conv in CONVERSION.finditer(fmt.decode("latin-1")):
+        out.append(fmt[last:conv.start()].decode("latin-1"))
+        last = conv.end()
+        flags, width, prec, _, kind = conv.groups()
+        spec = "%" + flags + width + ("." + prec if prec else "")
+        if kind == "%":
+            out.append("%")
+        elif kind == "s":
+            n, pos = read_varint(args, pos)
+            out.append((spec + "s") % args[pos:pos + n].decode("latin-1"))
+            pos += n
+        elif kind in "fFeEgG":
+            out.append((spec + kind) % struct.unpack_from("<f", args, pos)[0])
+            pos += 4
+        else:
+            z, pos = read_varint(args, pos)
+            value = (z >> 1) ^ -(z & 1)
+            if kind in "ouxXc":
+                value &= 0xFFFFFFFF
+            out.append((spec + ("d" if kind in "di" else kind)) % value)
+    out.append(fmt[last:].decode("latin-1"))
+    return "".join(out)
+
+
+def decode(data, formats):
+    pos = 0
+    while pos < len(data):
+        if len(data) - pos < HEADER.size:
+            sys.stdout.write(data[pos:].decode("latin-1"))
+            break
+        magic, version, _, epoch, now_ms, base_ms, dropped, size = HEADER.unpack_from(data, pos)
+        if magic != b"GL" or version != 1:
+            # text log batches in between are passed through
+            start = data.find(MAGIC, pos)
+            end = len(data) if start < 0 else start
+            sys.stdout.write(data[pos:end].decode("latin-1"))
+            pos = end
+            continue
+        pos += HEADER.size
+        if dropped:
+            print("%d log records dropped." % dropped)
+        ms = base_ms
+        end = pos + size
+        while pos < end:
+            length = data[pos]
+            rec = data[pos + 1:pos + 1 + length]
+            pos += 1 + length
+            fid = struct.unpack_from("<I", rec)[0]
+            delta, argpos = read_varint(rec, 4)
+            ms = (ms + delta) & 0xFFFFFFFF
+            if epoch:
+                when = datetime.datetime.fromtimestamp(epoch - ((now_ms - ms) & 0xFFFFFFFF) / 1000.0, datetime.timezone.utc)
+                stamp = when.strftime("%Y-%m-%d %H:%M:%S.") + "%03d" % (when.microsecond // 1000)
+            else:
+                stamp = "%d.%03d" % (ms // 1000, ms % 1000)
+            fmt = formats.get(fid)
+            if fmt is None:
+                print("%s <unknown format %08x, %d bytes>" % (stamp, fid, len(rec)))
+                continue
+            try:
+                print(stamp, format_record(fmt, rec, argpos))
+            except (IndexError, struct.error):
+                print("%s <truncated record for \"%s\">" % (stamp, fmt.decode("latin-1")))
+
+
+def main():
+    here = os.path.dirname(os.path.abspath(__file__))
+    parser = argparse.ArgumentParser(description="Decode LOG_BINARY log batches.")
+    parser.add_argument("--src", action="append",
+                        help="source directory with the logd() calls")
+    parser.add_argument("file", nargs="?")
+    opts = parser.parse_args()
+
+    dirs = opts.src or [os.path.join(here, "..", "src"), os.path.join(here, "..", "include")]
+    formats = scan_formats(dirs)
+    if opts.file:
+        with open(opts.file, "rb") as f:
+            data = f.read()
+    else:
+        data = sys.stdin.buffer.read()
+    decode(data, formats)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,234 @@
+#!/usr/bin/env python3
+"""Local stand-in for the iot-helper api, for testing the firmware without the router.
+
+Serves the config pull and accepts notifications, logs and door journal
+batches, in json or MessagePack. MessagePack is answered when the device asks for it in Accept,
+unless --json is given; notifications and logs are printed as text.
+
+Usage: mockserver.py [--port N] [--config FILE] [--json]
+Build the firmware with IOT_SERVICE_FQDN set to "<this host>:<port>".
+"""
+
+import argparse
+import hashlib
+import json
+import os
+import struct
+import sys
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from urllib.parse import urlparse, parse_qs
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import logdecode  # noqa: E402
+
+API_BASE = "/cgi-bin/luci/iot-helper/api"
+MSGPACK = "application/msgpack"
+
+# Same texts as createEventMessage() in src/notify.cpp, by event id.
+EVENTS = {
+    1: ("Info", "Garage door auto closing",
+        "The garage door was found open when it should have been closed."),
+    2: ("Info", "Garage door lost time",
+        "The current time can not be reliably determined. Functions that rely on correct current time will be suspended."),
+    3: ("Info", "Garage door getting bad data", "See message below from monitor."),
+    4: ("Info", "Garage door monitor reset",
+        "The garage door monitor has been reset. This could be due to power cycle, or code crash."),
+    5: ("Warning", "Garage door closing failure", "There was an error trying to close the garage door."),
+    6: ("Critical", "Garage door is now closed", "The garage door is now closed as expected."),
+    7: ("Info", "Failure parsing configuration",
+        "Failed to parse the configuration data retrieved from the server."),
+    8: ("Info", "Door control is disabled",
+        "Door would have closed by now, but control has been disabled."),
+    9: ("Warning", "Garage door closing slowly",
+        "The garage door took much longer than usual to close. The opener may need a look."),
+}
+NOTIFY_KEYS = {0: "event", 1: "detail", 2: "count", 3: "first", 4: "last", 5: "door"}
+
+# Door journal record types (the door is in the high nibble) and door states, see include/main.h.
+JOURNAL_TYPES = {0: "reset", 1: "door", 2: "close attempt", 3: "close result", 4: "travel"}
+DOOR_STATES = {-2: "Unstable", -1: "Unknown", 0: "Open", 1: "Closed", 2: "Ajar"}
+
+
+def msgpack_pack(value):
+    if value is None:
+        return b"\xc0"
+    if value is True or value is False:
+        return b"\xc3" if value else b"\xc2"
+    if isinstance(value, int):
+        if 0 <= value < 0x80:
+            return bytes([value])
+        if -32 <= value < 0:
+            return struct.pack("b", value)
+        if value >= 0:
+            return b"\xce" + struct.pack(">I", value)
+        return b"\xd2" + struct.pack(">i", value)
+    if isinstance(value, str):
+        raw = value.encode("utf-8")
+        if len(raw) < 32:
+            return bytes([0xA0 | len(raw)]) + raw
+        return b"\xda" + struct.pack(">H", len(raw)) + raw
+    if isinstance(value, (list, tuple)):
+        head = bytes([0x90 | len(value)]) if len(value) < 16 else b"\xdc" + struct.pack(">H", len(value))
+        return head + b"".join(msgpack_pack(v) for v in value)
+    if isinstance(value, dict):
+        head = bytes([0x80 | len(value)]) if len(value) < 16 else b"\xde" + struct.pack(">H", len(value))
+        return head + b"".join(msgpack_pack(k) + msgpack_pack(v) for k, v in value.items())
+    raise TypeError("cannot pack %r" % (value,))
+
+
+def msgpack_unpack(data, pos=0):
+    """Returns (value, next position) for the subset the device sends."""
+    b = data[pos]
+    pos += 1
+    if b <= 0x7F:
+        return b, pos
+    if b >= 0xE0:
+        return b - 0x100, pos
+    if b & 0xE0 == 0xA0:
+        n = b & 0x1F
+        return data[pos:pos + n].decode("utf-8", "replace"), pos + n
+    if b & 0xF0 in (0x80, 0x90):
+        n = b & 0x0F
+        return _unpack_container(data, pos, n, b & 0xF0 == 0x80)
+    fixed = {0xCC: ">B", 0xCD: ">H", 0xCE: ">I", 0xD0: ">b", 0xD1: ">h", 0xD2: ">i"}
+    if b in fixed:
+        size = struct.calcsize(fixed[b])
+        return struct.unpack_from(fixed[b], data, pos)[0], pos + size
+    if b in (0xD9, 0xDA):
+        size = 1 if b == 0xD9 else 2
+        n = int.from_bytes(data[pos:pos + size], "big")
+        pos += size
+        return data[pos:pos + n].decode("utf-8", "replace"), pos + n
+    if b in (0xDC, 0xDE):
+        n = struct.unpack_from(">H", data, pos)[0]
+        return _unpack_container(data, pos + 2, n, b == 0xDE)
+    if b in (0xC0, 0xC2, 0xC3):
+        return {0xC0: None, 0xC2: False, 0xC3: True}[b], pos
+    raise ValueError("unsupported msgpack type 0x%02x" % b)
+
+
+def _unpack_container(data, pos, n, is_map):
+    if is_map:
+        result = {}
+        for _ in range(n):
+            key, pos = msgpack_unpack(data, pos)
+            result[key], pos = msgpack_unpack(data, pos)
+        return result, pos
+    result = []
+    for _ in range(n):
+        item, pos = msgpack_unpack(data, pos)
+        result.append(item)
+    return result, pos
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"   # keep-alive, like the real server
+
+    def log_message(self, fmt, *args):
+        if self.server.opts.verbose:
+            super().log_message(fmt, *args)
+
+    def reply(self, code, body=b"", headers=()):
+        self.send_response(code)
+        for name, value in headers:
+            self.send_header(name, value)
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def do_GET(self):
+        url = urlparse(self.path)
+        if url.path != API_BASE + "/config":
+            return self.reply(404)
+
+        opts = self.server.opts
+        config = {}
+        if opts.config:
+            with open(opts.config) as f:
+                config = json.load(f)
+        use_msgpack = not opts.json and MSGPACK in self.headers.get("Accept", "")
+        if use_msgpack:
+            body, content_type = msgpack_pack(config), MSGPACK
+        else:
+            body, content_type = json.dumps(config).encode(), "application/json"
+        etag = '"%s"' % hashlib.sha1(body).hexdigest()[:16]
+        headers = [("X-IoT-LocalTime", time.strftime("%Y%m%d%H%M%S")), ("ETag", etag)]
+        if self.headers.get("If-None-Match") == etag:
+            return self.reply(304, headers=headers)
+        print("config -> %s, %d bytes of %s" % (parse_qs(url.query).get("deviceid", ["?"])[0], len(body), content_type))
+        self.reply(200, body, headers + [("Content-Type", content_type)])
+
+    def do_POST(self):
+        url = urlparse(self.path)
+        body = self.rfile.read(int(self.headers.get("Content-Length", 0)))
+        content_type = self.headers.get("Content-Type", "")
+        if url.path == API_BASE + "/notify":
+            self.print_notification(body, content_type)
+        elif url.path == API_BASE + "/journal":
+            self.print_journal(body)
+        elif url.path == API_BASE + "/log":
+            if parse_qs(url.query).get("format") == ["bin"]:
+                logdecode.decode(body, self.server.formats)
+            else:
+                sys.stdout.write(body.decode("utf-8", "replace"))
+        else:
+            return self.reply(404)
+        sys.stdout.flush()
+        self.reply(200)
+
+    def print_journal(self, body):
+        magic, version, rec_size, epoch, now_ms, dropped = struct.unpack_from("<2sBBIII", body)
+        if magic != b"GJ" or version != 1:
+            print("journal: unknown batch %r" % body[:4])
+            return
+        print("journal: %d records, %d dropped" % ((len(body) - 16) // rec_size, dropped))
+        for offset in range(16, len(body) - rec_size + 1, rec_size):
+            seq, utc, ms, kind, value, detail = struct.unpack_from("<IIIBBh", body, offset)
+            door, kind = kind >> 4, kind & 0x0f
+            when = time.strftime("%Y-%m-%d %H:%M:%S", time.gmtime(utc)) + " UTC" if utc else \
+                "%.1f s ago" % ((now_ms - ms) / 1000.0)
+            if kind == 1:
+                text = "%s, sensor %d" % (DOOR_STATES.get(value, value), detail)
+            elif kind == 2:
+                text = "try %d, door %s" % (value, DOOR_STATES.get(detail, detail))
+            elif kind == 3:
+                text = "%s, door %s" % ("closed" if value else "failed", DOOR_STATES.get(detail, detail))
+            elif kind == 4:
+                text = "%.1f s%s" % (detail / 10.0, ", slow" if value else "")
+            else:
+                text = ""
+            print("  #%d %s door %d %s %s" % (seq, when, door, JOURNAL_TYPES.get(kind, kind), text))
+
+    def print_notification(self, body, content_type):
+        if content_type.startswith(MSGPACK):
+            fields = {NOTIFY_KEYS.get(k, k): v for k, v in msgpack_unpack(body)[0].items()}
+            kind, subject, message = EVENTS.get(fields["event"], ("Info", "Unknown event", "Message for an unknown event: %d" % fields["event"]))
+            if "door" in fields:
+                subject += " (door %d)" % fields["door"]
+            print("notify [%s] %s (%d bytes msgpack)\n  %s\n  %s" % (kind, subject, len(body), message, fields.get("detail", "")))
+            if "count" in fields:
+                print("  Occurred %d times, first %d s ago, last %d s ago." % (fields["count"], fields["first"], fields["last"]))
+        else:
+            msg = json.loads(body)
+            print("notify [%s] %s (%d bytes json)\n  %s" % (msg["type"], msg["subject"], len(body), msg["message"].replace("\n", "\n  ")))
+
+
+def main():
+    here = os.path.dirname(os.path.abspath(__file__))
+    parser = argparse.ArgumentParser(description="Mock iot-helper api server.")
+    parser.add_argument("--port", type=int, default=8080)
+    parser.add_argument("--config", help="json file served as the device config")
+    parser.add_argument("--json", action="store_true", help="never answer msgpack")
+    parser.add_argument("--verbose", action="store_true")
+    opts = parser.parse_args()
+
+    server = ThreadingHTTPServer(("", opts.port), Handler)
+    server.opts = opts
+    server.formats = logdecode.scan_formats([os.path.join(here, "..", "src"), os.path.join(here, "..", "include")])
+    print("Listening on port %d" % opts.port)
+    server.serve_forever()
+
+
+if __name__ == "__main__":
+    main()